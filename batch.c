@@ -0,0 +1,368 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bilebio.h"
+
+/* bilebio-batch: plays a batch of games with random plain moves (leaning
+ * towards the exit side) through simulate_bilebio() and reports its speed.
+ * With -v a second copy of the games is stepped by step_bilebio() and
+ * compared with the first after every turn; the games then also use
+ * abilities (see VERIFY_ABILITY_ONE_IN). With -e it instead plays the
+ * games under each activation engine and checks that the two agree in
+ * distribution: per-turn activation rates by plant type, and turns to
+ * death. With -w it checks rollouts simulated over set_horizon()'s window
+ * against the whole stage. */
+
+static const char move_chars[] = "hjklyubn.lllllunl";
+/* The move keys by direction, row by row. */
+static const char step_keys[] = "yku" "h.l" "bjn";
+
+/* Under -v every game knows every ability (all but Life in every other
+ * game, so that players still die) and has VERIFY_ENERGY to spend, and one
+ * move in VERIFY_ABILITY_ONE_IN is made with an ability drawn at random.
+ * The key-driven copy selects it with its key, moves and selects '0'
+ * again; the stepped copy sets selected_ability around step_bilebio(), as
+ * the borg's play_action() does. */
+#define VERIFY_ABILITY_ONE_IN 3
+#define VERIFY_ENERGY 100000
+
+static void grant_abilities(struct bilebio *bb, int g)
+{
+    int a;
+
+    for (a = 1; a < NUM_ABILITIES; ++a)
+        bb->abilities[a] = a != ABILITY_LIFE || g % 2;
+    bb->player_energy = VERIFY_ENERGY;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-k games] [-t turns] [-s seed] [-v | -e | -w]\n", argv0);
+    exit(1);
+}
+
+static int same_game(const struct bilebio *a, const struct bilebio *b)
+{
+    int x, y;
+    const struct tile *s, *t;
+
+    for (y = 0; y < STAGE_HEIGHT; ++y) {
+        for (x = 0; x < STAGE_WIDTH; ++x) {
+            s = &STAGE(a, x, y);
+            t = &STAGE(b, x, y);
+            if (s->type != t->type || s->growth != t->growth || tile_age(a, s) != tile_age(b, t) ||
+                !s->active != !t->active || !s->dead != !t->dead)
+                return 0;
+        }
+    }
+    return a->stage_level == b->stage_level && a->stage_age == b->stage_age &&
+           a->stage_template == b->stage_template &&
+           a->player_x == b->player_x && a->player_y == b->player_y &&
+           !a->player_dead == !b->player_dead && a->player_score == b->player_score &&
+           a->player_energy == b->player_energy && a->rng == b->rng;
+}
+
+/* What compare_engines() tallies for one engine. The chance of activation
+ * rises with the stage, and the engines need not reach the same stages, so
+ * activations are weighed against their expected number, the sum of the
+ * chances of the plants that could activate. */
+struct engine_stats {
+    double expected[3], activated[3];
+    double deaths, life, life2;
+    clock_t time;
+};
+
+static void play_engine(enum engine engine, int games, unsigned long turns, unsigned long seed,
+                        struct bilebio *bb, struct engine_stats *es)
+{
+    int g, x, y;
+    unsigned long t, move_rng = seed, resets = 0, level;
+    const struct tile *tile;
+    double expected[3];
+    unsigned long lifespan[3];
+    clock_t start;
+
+    memset(es, 0, sizeof(*es));
+    lifespan[0] = default_rules.root_lifespan;
+    lifespan[1] = default_rules.flower_lifespan;
+    lifespan[2] = default_rules.vine_lifespan;
+    for (g = 0; g < games; ++g) {
+        init_bilebio(&bb[g], seed + g);
+        set_engine(&bb[g], engine);
+    }
+    for (t = 0; t < turns; ++t) {
+        for (g = 0; g < games; ++g) {
+            expected[0] = expected[1] = expected[2] = 0;
+            for (y = 0; y < STAGE_HEIGHT; ++y) {
+                for (x = 0; x < STAGE_WIDTH; ++x) {
+                    tile = &STAGE(&bb[g], x, y);
+                    /* Plants that die of age this turn are gone before
+                     * they can be seen active. */
+                    if (TILE_IS_PLANT(*tile) && !tile->active &&
+                        (tile->type == TILE_ROOT || tile->growth > 0) &&
+                        tile_age(&bb[g], tile) < lifespan[tile->type - TILE_ROOT])
+                        expected[tile->type - TILE_ROOT] += (bb[g].active_threshold[tile->type] + 1.0) / 4294967296.0;
+                }
+            }
+            level = bb[g].stage_level;
+            start = clock();
+            if (simulate_bilebio(&bb[g], move_chars[rand_next(&move_rng, 0) % (sizeof(move_chars) - 1)]) ==
+                STATUS_DEAD) {
+                es->time += clock() - start;
+                es->deaths += 1;
+                es->life += bb[g].stage_age;
+                es->life2 += (double)bb[g].stage_age * bb[g].stage_age;
+                init_bilebio(&bb[g], seed + games + resets++);
+                set_engine(&bb[g], engine);
+                continue;
+            }
+            es->time += clock() - start;
+            /* A new stage replaces the plants counted. */
+            if (bb[g].stage_level != level)
+                continue;
+            for (x = 0; x < 3; ++x)
+                es->expected[x] += expected[x];
+            for (y = 0; y < STAGE_HEIGHT; ++y) {
+                for (x = 0; x < STAGE_WIDTH; ++x) {
+                    tile = &STAGE(&bb[g], x, y);
+                    if (TILE_IS_PLANT(*tile) && tile->active)
+                        es->activated[tile->type - TILE_ROOT] += 1;
+                }
+            }
+        }
+    }
+}
+
+/* Plays the same games under ENGINE_SCAN and ENGINE_EVENTS and prints a
+ * z-score for each statistic. The draws differ, so the games do too; only
+ * the distributions should agree. Plants the player tramples before they
+ * can activate pull both engines' ratios a little below 1 alike.
+ * Returns the number of |z| over 4. */
+static int compare_engines(int games, unsigned long turns, unsigned long seed)
+{
+    static const char *names[3] = { "root", "flower", "vine" };
+    struct engine_stats es[2];
+    struct bilebio *bb;
+    double r0, r1, z, m0, m1, v0, v1;
+    int i, e, failures = 0;
+
+    if (!(bb = malloc(games * sizeof(*bb)))) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    for (e = 0; e < 2; ++e)
+        play_engine(e ? ENGINE_EVENTS : ENGINE_SCAN, games, turns, seed, bb, &es[e]);
+    free(bb);
+
+    printf("%d games x %lu turns per engine\n", games, turns);
+    printf("%-8s %12s %12s %8s\n", "", "scan", "events", "z");
+    for (i = 0; i < 3; ++i) {
+        /* Activations are near enough Poisson. */
+        r0 = es[0].activated[i] / es[0].expected[i];
+        r1 = es[1].activated[i] / es[1].expected[i];
+        z = (r1 - r0) / sqrt(r0 / es[0].expected[i] + r1 / es[1].expected[i]);
+        printf("%-8s %12.4f %12.4f %8.2f\n", names[i], r0, r1, z);
+        failures += fabs(z) > 4;
+    }
+    m0 = es[0].life / es[0].deaths;
+    m1 = es[1].life / es[1].deaths;
+    v0 = (es[0].life2 / es[0].deaths - m0 * m0) / es[0].deaths;
+    v1 = (es[1].life2 / es[1].deaths - m1 * m1) / es[1].deaths;
+    z = (m1 - m0) / sqrt(v0 + v1);
+    printf("%-8s %12.2f %12.2f %8.2f\n", "life", m0, m1, z);
+    failures += fabs(z) > 4;
+    printf("%-8s %11.0f/s %11.0f/s\n", "speed", games * (double)turns / ((double)es[0].time / CLOCKS_PER_SEC),
+           games * (double)turns / ((double)es[1].time / CLOCKS_PER_SEC));
+    return failures;
+}
+
+/* Rollouts compare_window() plays from each position, and their length:
+ * the borg's by default. */
+#define WINDOW_ROLLOUTS 16
+#define WINDOW_TURNS    5
+
+/* Plays a rollout of random plain moves from bb, as the borg does: it ends
+ * early if the player clears the stage. Returns 1 if the player died. */
+static int play_rollout(struct bilebio *bb, unsigned long move_rng)
+{
+    const unsigned long level = bb->stage_level;
+    int t;
+
+    for (t = 0; t < WINDOW_TURNS && bb->stage_level == level; ++t)
+        if (simulate_bilebio(bb, move_chars[rand_next(&move_rng, 0) % (sizeof(move_chars) - 1)]) == STATUS_DEAD)
+            return 1;
+    return 0;
+}
+
+/* Plays rollouts from positions along random games over the whole stage
+ * and over the window of set_horizon(), with the same draws, and checks
+ * that the chance of death differs by no more than window_error_bound()
+ * allows: the mean paired difference is within the mean bound and four
+ * standard errors. Positions are taken every 25 turns. */
+static int compare_window(int games, unsigned long turns, unsigned long seed)
+{
+    struct bilebio bb, full, window;
+    unsigned long t, n = 0, resets = 0, move_rng = seed, rollout_rng;
+    double deaths[2] = { 0, 0 }, diff2 = 0, bound = 0, mean, se;
+    clock_t start, time[2] = { 0, 0 };
+    int g, i, d[2];
+
+    for (g = 0; g < games; ++g) {
+        init_bilebio(&bb, seed + g);
+        for (t = 1; t <= turns; ++t) {
+            if (simulate_bilebio(&bb, move_chars[rand_next(&move_rng, 0) % (sizeof(move_chars) - 1)]) ==
+                STATUS_DEAD)
+                init_bilebio(&bb, seed + games + resets++);
+            if (t % 25)
+                continue;
+            bound += window_error_bound(&bb, WINDOW_TURNS) * WINDOW_ROLLOUTS;
+            for (i = 0; i < WINDOW_ROLLOUTS; ++i) {
+                rollout_rng = rand_next(&move_rng, 0);
+                start = clock();
+                copy_bilebio(&full, &bb);
+                bilebio_seed(&full, rollout_rng);
+                d[0] = play_rollout(&full, rollout_rng);
+                time[0] += clock() - start;
+                start = clock();
+                copy_bilebio(&window, &bb);
+                bilebio_seed(&window, rollout_rng);
+                set_horizon(&window, WINDOW_TURNS);
+                d[1] = play_rollout(&window, rollout_rng);
+                time[1] += clock() - start;
+                deaths[0] += d[0];
+                deaths[1] += d[1];
+                diff2 += (d[1] - d[0]) * (d[1] - d[0]);
+                ++n;
+            }
+        }
+    }
+    if (!n)
+        return 0;
+
+    mean = (deaths[1] - deaths[0]) / n;
+    se = sqrt((diff2 / n - mean * mean) / n);
+    printf("%lu rollouts of %d turns\n", n, WINDOW_TURNS);
+    printf("%-8s %12s %12s\n", "", "stage", "window");
+    printf("%-8s %12.4f %12.4f\n", "deaths", deaths[0] / n, deaths[1] / n);
+    printf("%-8s %11.0f/s %11.0f/s\n", "speed", n / ((double)time[0] / CLOCKS_PER_SEC),
+           n / ((double)time[1] / CLOCKS_PER_SEC));
+    printf("difference %.4f (se %.4f), bound %.4f\n", mean, se, bound / n);
+    return fabs(mean) > bound / n + 4 * se;
+}
+
+int main(int argc, char **argv)
+{
+    int games = 256, verify = 0, engines = 0, window = 0, g, i;
+    unsigned long turns = 1000, seed = (unsigned long)time(NULL), t, resets = 0, mismatches = 0;
+    unsigned long move_rng, max_stage = 0;
+    unsigned long ability_turns[NUM_ABILITIES], ability_effects[NUM_ABILITIES];
+    struct bilebio *scalar = NULL, *stepped = NULL, *plain = NULL;
+    const char *key;
+    int move, ability;
+    enum status st;
+    clock_t start, scalar_time = 0;
+
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-k") && i + 1 < argc)
+            games = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            turns = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-v"))
+            verify = 1;
+        else if (!strcmp(argv[i], "-e"))
+            engines = 1;
+        else if (!strcmp(argv[i], "-w"))
+            window = 1;
+        else
+            usage(argv[0]);
+    }
+    if (engines)
+        return compare_engines(games, turns, seed) != 0;
+    if (window)
+        return compare_window(games, turns, seed);
+
+    if (!(scalar = malloc(games * sizeof(*scalar))) ||
+        (verify && (!(stepped = malloc(games * sizeof(*stepped))) || !(plain = malloc(sizeof(*plain)))))) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    memset(ability_turns, 0, sizeof(ability_turns));
+    memset(ability_effects, 0, sizeof(ability_effects));
+    for (g = 0; g < games; ++g) {
+        init_bilebio(&scalar[g], seed + g);
+        if (verify) {
+            grant_abilities(&scalar[g], g);
+            init_bilebio(&stepped[g], seed + g);
+            grant_abilities(&stepped[g], g);
+        }
+    }
+    move_rng = seed;
+
+    for (t = 0; t < turns; ++t) {
+        for (g = 0; g < games; ++g) {
+            move = move_chars[rand_next(&move_rng, 0) % (sizeof(move_chars) - 1)];
+            ability = ABILITY_MOVE;
+            if (verify && rand_next(&move_rng, 0) % VERIFY_ABILITY_ONE_IN == 0) {
+                ability = 1 + rand_next(&move_rng, 0) % (NUM_ABILITIES - 1);
+                ++ability_turns[ability];
+                /* What the move would have done without the ability. */
+                copy_bilebio(plain, &scalar[g]);
+                simulate_bilebio(plain, move);
+                simulate_bilebio(&scalar[g], '0' + ability);
+            }
+            start = clock();
+            st = simulate_bilebio(&scalar[g], move);
+            scalar_time += clock() - start;
+
+            if (verify) {
+                if (ability != ABILITY_MOVE) {
+                    simulate_bilebio(&scalar[g], '0');
+                    if (!same_game(plain, &scalar[g]))
+                        ++ability_effects[ability];
+                }
+                key = strchr(step_keys, move);
+                stepped[g].selected_ability = ability;
+                if (step_bilebio(&stepped[g], (key - step_keys) % 3 - 1, (key - step_keys) / 3 - 1) != st)
+                    ++mismatches;
+                else {
+                    stepped[g].selected_ability = ABILITY_MOVE;
+                    if (!same_game(&stepped[g], &scalar[g]) ||
+                        stepped[g].selected_ability != scalar[g].selected_ability)
+                        ++mismatches;
+                }
+            }
+            if (scalar[g].stage_level > max_stage)
+                max_stage = scalar[g].stage_level;
+            if (st == STATUS_DEAD) {
+                init_bilebio(&scalar[g], seed + games + resets);
+                if (verify) {
+                    grant_abilities(&scalar[g], g);
+                    init_bilebio(&stepped[g], seed + games + resets);
+                    grant_abilities(&stepped[g], g);
+                }
+                ++resets;
+            }
+        }
+    }
+
+    printf("%d games x %lu turns, %lu deaths, best stage %lu\n", games, turns, resets, max_stage);
+    printf("simulate_bilebio: %.3fs (%.0f turns/s)\n", (double)scalar_time / CLOCKS_PER_SEC,
+           games * (double)turns / ((double)scalar_time / CLOCKS_PER_SEC));
+    if (verify) {
+        printf("ability moves (that did other than a plain move):");
+        for (i = 1; i < NUM_ABILITIES; ++i)
+            printf(" %s %lu (%lu)", ability_names[i], ability_turns[i], ability_effects[i]);
+        printf("\n%lu mismatches\n", mismatches);
+    }
+
+    free(scalar);
+    free(stepped);
+    free(plain);
+    return mismatches != 0;
+}
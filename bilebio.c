@@ -1,7 +1,15 @@
 #include "bilebio.h"
 #include "borg.h"
+#include "snapshot.h"
+#ifndef BILEBIO_LIB
+#include "ponder.h"
+#endif
+#ifdef RUN_BORG
+#include "results.h"
+#include "stagegen.h"
+#endif
 
-const char *ability_names[] = {
+const char *ability_names[NUM_ABILITIES] = {
     "Move",
     "Dash",
     "Plant Hop",
@@ -14,27 +22,92 @@ const char *ability_names[] = {
     "Energy",
 };
 
-const struct {
-    unsigned long initial;
-    unsigned long recurring;
-} ability_costs[] = {
-    {0, 0},
-    {10, 2},
-    {30, 2},
-    {60, 10},
-    {10, 2},
-    {30, 1},
-    {60, 50},
-    {10, 5},
-    {30, 5},
-    {60, 0},
-};
+#define SAVE_FILE "bilebio.sav"
+/* How often the game looks for a hint while the player thinks. */
+#define HINT_POLL_MS 50
 
-int main(void)
+#ifdef RUN_BORG
+static struct borg borg;
+#endif
+
+#ifndef BILEBIO_LIB
+/* Searches while the screen is drawn (bilebio-borg) or while the player
+ * thinks (hints); NULL if it could not be started. */
+static struct ponder *ponder;
+#endif
+
+#if !defined(RUN_BORG) && !defined(BILEBIO_LIB)
+/* 'H' toggles hints: what the borg would play and where plants can grow
+ * in the next two turns. The borg thinks on a copy of the game, so hints
+ * do not change it. */
+static struct borg hint_borg;
+static struct bilebio hint_position;
+static int hints;
+#endif
+
+#ifndef BILEBIO_LIB
+int main(int argc, char **argv)
 {
     enum status st;
     struct bilebio bb;
     int i, x, y;
+    unsigned long seed;
+    const char *resume = NULL, *rules = NULL;
+    char *args[2];
+    int num_args = 0;
+#ifdef RUN_BORG
+    unsigned long count, level, age, turns = 0, start_level;
+    stage_t *corpus;
+    struct results_sink *sink;
+    struct result result;
+#endif
+
+    /* -r <snapshot> resumes a saved game, -c <config> changes the rules. */
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            resume = argv[++i];
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+            rules = argv[++i];
+        else if (num_args < 2)
+            args[num_args++] = argv[i];
+    }
+
+#ifdef RUN_BORG
+    /* bilebio-borg [count [seed]]: play on a fresh corpus of generated
+     * stages instead of the hand-drawn ones. */
+    if (num_args > 0) {
+        count = strtoul(args[0], NULL, 0);
+        corpus = stagegen_corpus(num_args > 1 ? strtoul(args[1], NULL, 0) : (unsigned long)time(NULL),
+                                 count, 0);
+        if (!corpus || !count) {
+            fprintf(stderr, "Could not generate %lu stages.\n", count);
+            return 1;
+        }
+        set_stage_pack((const struct tile (*)[STAGE_HEIGHT][STAGE_WIDTH])corpus, count);
+    }
+#else
+    (void)args;
+#endif
+
+    seed = (unsigned long)time(NULL);
+
+    init_bilebio(&bb, seed);
+    if (resume && !load_bilebio(&bb, resume)) {
+        fprintf(stderr, "%s: not a BileBio snapshot.\n", resume);
+        return 1;
+    }
+    if (rules) {
+        struct rules r = bb.rules;
+        if (!load_rules(&r, rules))
+            return 1;
+        set_rules(&bb, &r);
+    }
+#ifdef RUN_BORG
+    if (!initialize_borg(&borg, &bb, "bbborg.log")) {
+        perror("bbborg.log");
+        return 1;
+    }
+#endif
 
     initscr();
     curs_set(0);
@@ -42,55 +115,109 @@ int main(void)
     start_color();
     keypad(stdscr, 1);
 
-    srand(time(NULL));
-
     for (i = 0; i < COLORS; ++i)
         init_pair(i, i, COLOR_BLACK);
 
-    init_bilebio(&bb);
-
 #ifdef RUN_BORG
-    initialize_borg( &bb );
+    borg_seed(&borg, seed);
+    ponder = ponder_new(&borg);
+    TRACE_OPEN("borg.current.trace.json");
+#else
+    TRACE_OPEN("bilebio.trace.json");
 #endif
 
+#ifdef RUN_BORG
+    start_level = bb.stage_level;
+    do {
+        level = bb.stage_level;
+        age = bb.stage_age;
+        st = update_bilebio(&bb);
+        turns += bb.stage_level == level ? bb.stage_age - age : bb.stage_age;
+    } while (st == STATUS_ALIVE);
+#else
     while ((st = update_bilebio(&bb)) == STATUS_ALIVE)
         ;
+#endif
 
     if (st == STATUS_DEAD) {
         /* Draw the stage. */
         for (y = 0; y < STAGE_HEIGHT; ++y)
             for (x = 0; x < STAGE_WIDTH; ++x)
-                mvaddch(y, x, tile_display(bb.stage[y][x]));
+                mvaddch(y, x, tile_display(STAGE(&bb, x, y)));
 #ifndef RUN_BORG
         set_status(0, RED, "You died on stage %d! You finished the game with a score of %d!\n", bb.stage_level, bb.player_score);
         set_status(1, BLUE, "Press 'Q' to quit.", bb.player_score);
         while ((i = getch()) != 'Q');
 #else
-        borg_postmortem();
+        borg_postmortem(&borg);
 #endif
     }
 
+    ponder_free(ponder);
     echo();
     endwin();
+    TRACE_CLOSE();
 
 #ifdef RUN_BORG
-    quit_borg();
-    {
-        FILE *f = fopen( "borg.current.data", "a" );
-        fprintf( f, "%lu\t%lu\t%lu\n", bb.player_score, bb.stage_level, bb.player_energy );
-        fclose( f );
-    }
+    quit_borg(&borg);
+    /* A resumed game was not dealt from seed; its seed is unknown. */
+    result_of(&result, &bb, resume ? 0 : seed, 0, st, turns, start_level);
+    sink = results_open("borg.current.results");
+    if (!sink || !(results_add(sink, &result) & results_close(sink)))
+        fprintf(stderr, "Could not record the game in borg.current.results.\n");
+    PERF_REPORT("borg.current.perf", "borg.current.perf.json");
+#else
+    if (hint_borg.log)
+        quit_borg(&hint_borg);
+    PERF_REPORT("bilebio.perf", "bilebio.perf.json");
 #endif
 
     return 0;
 }
+#endif
+
+#define OFFSET(dx, dy)  { dx, dy, (dy) * GRID_WIDTH + (dx) }
+
+const struct offset ring_offsets[8] = {
+    OFFSET(-1, -1), OFFSET(0, -1), OFFSET(1, -1),
+    OFFSET(-1,  0),                OFFSET(1,  0),
+    OFFSET(-1,  1), OFFSET(0,  1), OFFSET(1,  1),
+};
+
+const struct offset window_offsets[24] = {
+    OFFSET(-2, -2), OFFSET(-1, -2), OFFSET(0, -2), OFFSET(1, -2), OFFSET(2, -2),
+    OFFSET(-2, -1), OFFSET(-1, -1), OFFSET(0, -1), OFFSET(1, -1), OFFSET(2, -1),
+    OFFSET(-2,  0), OFFSET(-1,  0),                OFFSET(1,  0), OFFSET(2,  0),
+    OFFSET(-2,  1), OFFSET(-1,  1), OFFSET(0,  1), OFFSET(1,  1), OFFSET(2,  1),
+    OFFSET(-2,  2), OFFSET(-1,  2), OFFSET(0,  2), OFFSET(1,  2), OFFSET(2,  2),
+};
+
+const struct offset knight_offsets[8] = {
+    OFFSET(-2, -1),
+    OFFSET( 2, -1),
+    OFFSET(-2,  1),
+    OFFSET( 2,  1),
+
+    OFFSET(-1, -2),
+    OFFSET(-1,  2),
+    OFFSET( 1, -2),
+    OFFSET( 1,  2),
+};
+
+/* Vines at the ends of the cross and on the diagonals, flowers next to
+ * the root. */
+const struct offset burst_offsets[12] = {
+    OFFSET(-2,  0), OFFSET(-1,  0), OFFSET( 1,  0), OFFSET( 2,  0),
+    OFFSET( 0, -2), OFFSET( 0, -1), OFFSET( 0,  1), OFFSET( 0,  2),
+    OFFSET( 1,  1), OFFSET(-1, -1), OFFSET(-1,  1), OFFSET( 1, -1),
+};
 
 struct tile make_plant(unsigned long type, unsigned long growth)
 {
     struct tile t;
     t.type = type;
     t.growth = growth;
-    t.age = t.active = t.dead = 0;
+    t.born = t.active = t.dead = 0;
     return t;
 }
 
@@ -98,18 +225,18 @@ struct tile make_tile(unsigned long type)
 {
     struct tile t;
     t.type = type;
-    t.growth = t.age = t.active = t.dead = 0;
+    t.growth = t.born = t.active = t.dead = 0;
     return t;
 }
 
 chtype tile_display(struct tile t)
 {
     static const chtype display[NUM_TILES] = {
-        '.', ',', '#', '@', '%', '*', '~', '$', '>'
+        '.', ',', '#', '@', '%', '*', '~', '$', '>', ' '
     };
     static const chtype color[NUM_TILES] = {
         WHITE, MAGENTA, YELLOW | A_BOLD, BLUE,
-        GREEN, MAGENTA, GREEN, YELLOW, CYAN
+        GREEN, MAGENTA, GREEN, YELLOW, CYAN, WHITE
     };
 
     if (t.active) {
@@ -121,9 +248,14 @@ chtype tile_display(struct tile t)
     return display[t.type] | color[t.type];
 }
 
-void init_bilebio(struct bilebio *bb)
+void init_bilebio(struct bilebio *bb, unsigned long seed)
 {
     int i;
+    bb->engine = ENGINE_SCAN;
+    bb->horizon = 0;
+    bb->scanned = 0;
+    bilebio_seed(bb, seed);
+    bb->rules = default_rules;
     bb->stage_level = 1;
     bb->player_score = 0;
     bb->player_dead = 0;
@@ -135,27 +267,417 @@ void init_bilebio(struct bilebio *bb)
     set_stage(bb);
 }
 
-#define NUM_STAGES 12
+unsigned long mix32(unsigned long x)
+{
+    x &= 0xffffffffUL;
+    x ^= x >> 16;
+    x = (x * 0x7feb352dUL) & 0xffffffffUL;
+    x ^= x >> 15;
+    x = (x * 0x846ca68bUL) & 0xffffffffUL;
+    x ^= x >> 16;
+    return x;
+}
+
+static void schedule_events(struct bilebio *bb);
+
+/* Every game carries its own random streams, so copies of a game (like
+ * the borg's holodecks) can be reseeded and replayed independently. */
+void bilebio_seed(struct bilebio *bb, unsigned long seed)
+{
+    bb->rng = mix32(seed);
+    bb->activation_seed = mix32(seed ^ 0x5bd1e995UL);
+    bb->antithetic = 0;
+    if (bb->engine == ENGINE_EVENTS)
+        schedule_events(bb);
+}
+
+void bilebio_set_antithetic(struct bilebio *bb, int antithetic)
+{
+    bb->antithetic = antithetic;
+    if (bb->engine == ENGINE_EVENTS)
+        schedule_events(bb);
+}
+
+/* Uniform 32-bit word. With bb->antithetic set, the complement of the
+ * word the same seed would otherwise give. */
+unsigned long bilebio_rand(struct bilebio *bb)
+{
+    return rand_next(&bb->rng, bb->antithetic);
+}
+
+/* The step behind bilebio_rand(), for engines keeping their own state. */
+unsigned long rand_next(unsigned long *rng, int antithetic)
+{
+    unsigned long r;
+    *rng = (*rng * 1664525UL + 1013904223UL) & 0xffffffffUL;
+    r = mix32(*rng);
+    return antithetic ? r ^ 0xffffffffUL : r;
+}
+
+/* Activation words are a function of the activation seed, stage, turn and
+ * cell only. The per-turn part is hashed once by activation_base(), and
+ * activation_word() finishes it for a cell. */
+unsigned long activation_base(struct bilebio *bb)
+{
+    return activation_key(bb->activation_seed, bb->stage_level, bb->stage_age);
+}
+
+unsigned long activation_key(unsigned long seed, unsigned long level, unsigned long age)
+{
+    return mix32(seed ^ mix32(level * 0x9e3779b9UL + age));
+}
+
+/* mix32() in plain 32-bit arithmetic. */
+static unsigned int activation_word(struct bilebio *bb, unsigned int base, int x, int y)
+{
+    unsigned int r = base + (unsigned int)(y * STAGE_WIDTH + x) * 0x85ebca6bU;
+    r ^= r >> 16;
+    r *= 0x7feb352dU;
+    r ^= r >> 15;
+    r *= 0x846ca68bU;
+    r ^= r >> 16;
+    return bb->antithetic ? r ^ 0xffffffffU : r;
+}
+
+/* A plant activates when floor(u * n) == 0 for u = word / 2^32 and
+ * n = b^2 / (l+b-1), i.e. when word * n < 2^32. */
+static unsigned long active_threshold(unsigned long base, unsigned long level)
+{
+    unsigned long n = (base * base) / (level + base - 1);
+    return n ? 0xffffffffUL / n : 0xffffffffUL;
+}
+
+void set_activation_thresholds(struct bilebio *bb)
+{
+    memset(bb->active_threshold, 0, sizeof(bb->active_threshold));
+    bb->active_threshold[TILE_ROOT] = active_threshold(bb->rules.root_active_base, bb->stage_level);
+    bb->active_threshold[TILE_FLOWER] = active_threshold(bb->rules.flower_active_base, bb->stage_level);
+    bb->active_threshold[TILE_VINE] = active_threshold(bb->rules.vine_active_base, bb->stage_level);
+    if (bb->engine == ENGINE_EVENTS)
+        schedule_events(bb);
+}
+
+/* Cells off a wheel have this prev. */
+#define OFF_WHEEL   (-2)
+/* Waits are capped here, far beyond any game. */
+#define MAX_WAIT    1000000000UL
+
+static int can_activate(const struct tile *t)
+{
+    return !t->active && (t->type == TILE_ROOT ||
+                          ((t->type == TILE_FLOWER || t->type == TILE_VINE) && t->growth > 0));
+}
+
+static void clear_wheel(struct wheel *w)
+{
+    int i;
+    for (i = 0; i < WHEEL_SLOTS; ++i)
+        w->head[i] = -1;
+    for (i = 0; i < GRID_CELLS; ++i)
+        w->prev[i] = OFF_WHEEL;
+}
+
+static void enqueue(struct wheel *w, int c, unsigned long when)
+{
+    const unsigned int slot = (unsigned int)when % WHEEL_SLOTS;
+    w->when[c] = (unsigned int)when;
+    w->prev[c] = -1;
+    w->next[c] = w->head[slot];
+    if (w->head[slot] >= 0)
+        w->prev[w->head[slot]] = c;
+    w->head[slot] = c;
+}
+
+static void unqueue(struct wheel *w, int c)
+{
+    if (w->prev[c] == OFF_WHEEL)
+        return;
+    if (w->prev[c] >= 0)
+        w->next[w->prev[c]] = w->next[c];
+    else
+        w->head[w->when[c] % WHEEL_SLOTS] = w->next[c];
+    if (w->next[c] >= 0)
+        w->prev[w->next[c]] = w->prev[c];
+    w->prev[c] = OFF_WHEEL;
+}
 
-const struct tile stages[NUM_STAGES][STAGE_HEIGHT][STAGE_WIDTH] = {
+static void mark_due(struct bilebio *bb, int c)
+{
+    bb->events.due[c / 32] |= 1U << (c % 32);
+}
+
+/* The turn cell c is next visited on, in this turn's scan or the next. */
+static unsigned long next_visit(const struct bilebio *bb, int c)
+{
+    return bb->stage_age + (c < bb->scanned);
+}
+
+/* Queues the plant at c, if it can activate, for the turn it will. From
+ * turn first on it activates each turn with chance p, so it waits
+ * floor(log(u) / log(1 - p)) turns for u uniform on (0, 1]. Rolls are
+ * independent from turn to turn, so a plant can be queued afresh at any
+ * time (new streams, new thresholds) without changing the odds. */
+static void schedule_activation(struct bilebio *bb, int c, unsigned long first)
+{
+    struct wheel *w = &bb->events.activations;
+    const struct tile *t = &bb->grid[c];
+    unsigned int word;
+    double p, wait;
+
+    unqueue(w, c);
+    if (!can_activate(t))
+        return;
+    p = (bb->active_threshold[t->type] + 1.0) / 4294967296.0;
+    word = activation_word(bb, (unsigned int)activation_key(bb->activation_seed, bb->stage_level, first),
+                           CELL_X(c), CELL_Y(c));
+    wait = p < 1 ? floor(log((word + 1.0) / 4294967296.0) / log(1 - p)) : 0;
+    enqueue(w, c, first + (wait < MAX_WAIT ? (unsigned long)wait : MAX_WAIT));
+}
+
+/* Queues the tile at c for the turn age_tile() next changes it on: when
+ * a plant dies and is cleared, nectar halves or runs out, or repellent
+ * wears off. Tiles due in the turn under way are marked for it instead. */
+static void schedule_expiry(struct bilebio *bb, int c)
+{
+    const struct rules *rules = &bb->rules;
+    const struct tile *t = &bb->grid[c];
+    const unsigned long visit = next_visit(bb, c);
+    /* The age age_tile() gives the tile on its next visit, and the age it
+     * is next changed at. */
+    const unsigned long first = visit + 1 - t->born;
+    unsigned long age;
+
+    unqueue(&bb->events.expiries, c);
+    switch (t->type) {
+    case TILE_ROOT:
+        age = rules->root_lifespan + (t->dead != 0);
+        break;
+    case TILE_FLOWER:
+        age = rules->flower_lifespan + (t->dead != 0);
+        break;
+    case TILE_VINE:
+        age = rules->vine_lifespan + (t->dead != 0);
+        break;
+    case TILE_NECTAR:
+        /* The next age one short of a multiple of the half life. */
+        if (t->growth <= 1 || !rules->nectar_half_life)
+            age = first;
+        else
+            age = first + (rules->nectar_half_life - 1 - first % rules->nectar_half_life);
+        break;
+    case TILE_REPELLENT:
+        age = rules->repellent_lifespan;
+        break;
+    default:
+        return;
+    }
+    if (age <= first)
+        age = first;
+    if (t->born + age - 1 == bb->stage_age)
+        mark_due(bb, c);
+    else
+        enqueue(&bb->events.expiries, c, t->born + age - 1);
+}
+
+/* Queues every cell afresh, from the next turn to be played. */
+static void schedule_events(struct bilebio *bb)
+{
+    int x, y, c;
+
+    clear_wheel(&bb->events.activations);
+    clear_wheel(&bb->events.expiries);
+    memset(bb->events.due, 0, sizeof(bb->events.due));
+    for (y = 0; y < STAGE_HEIGHT; ++y) {
+        for (x = 0; x < STAGE_WIDTH; ++x) {
+            c = CELL(x, y);
+            if (TILE_IS_PLANT(bb->grid[c]) && bb->grid[c].active)
+                mark_due(bb, c);
+            schedule_activation(bb, c, bb->stage_age);
+            schedule_expiry(bb, c);
+        }
+    }
+}
+
+/* Activates the plants due this turn, to grow next turn. Cells whose
+ * plant has gone or changed since it was queued are dropped. */
+static void wake_plants(struct bilebio *bb)
+{
+    struct wheel *w = &bb->events.activations;
+    const unsigned int now = (unsigned int)bb->stage_age;
+    struct tile *t;
+    int c, next;
+
+    for (c = w->head[now % WHEEL_SLOTS]; c >= 0; c = next) {
+        next = w->next[c];
+        if (w->when[c] != now)
+            continue;
+        unqueue(w, c);
+        t = &bb->grid[c];
+        if (!can_activate(t))
+            continue;
+        t->active = 1;
+        mark_due(bb, c);
+        if (t->type == TILE_ROOT)
+            PERF_COUNT(PERF_ACTIVATE_ROOT);
+        else if (t->type == TILE_FLOWER)
+            PERF_COUNT(PERF_ACTIVATE_FLOWER);
+        else
+            PERF_COUNT(PERF_ACTIVATE_VINE);
+    }
+}
+
+void set_engine(struct bilebio *bb, enum engine engine)
+{
+    bb->engine = engine;
+    if (engine == ENGINE_EVENTS)
+        schedule_events(bb);
+}
+
+/* Copies a game; the schedule only matters, and is only copied, under
+ * ENGINE_EVENTS. */
+void copy_bilebio(struct bilebio *dst, const struct bilebio *src)
+{
+    memcpy(dst, src, src->engine == ENGINE_EVENTS ? sizeof(*src) : offsetof(struct bilebio, events));
+}
+
+/* copy_bilebio() for a copy to be played under ENGINE_SCAN, such as a
+ * rollout, whatever the engine of src: the schedule is left behind. */
+void copy_bilebio_scan(struct bilebio *dst, const struct bilebio *src)
+{
+    memcpy(dst, src, offsetof(struct bilebio, events));
+    dst->engine = ENGINE_SCAN;
+}
+
+/* Has ENGINE_SCAN simulate only the window around the player for the
+ * next turns turns (0 for the whole stage again). Play no more turns than
+ * that: the frozen cells have missed their ageing. */
+void set_horizon(struct bilebio *bb, int turns)
+{
+    bb->horizon = turns;
+}
+
+/* Bounds how much set_horizon(bb, turns) can change the chance of any
+ * outcome of the turns played from here. A cell d steps from the player
+ * is frozen for the last turns r with WINDOW_RADIUS(r) < d; outside the
+ * window only a root seeding near the player matters. A root grows in a
+ * turn if it was active, or activated the turn before, and then seeds one
+ * time in five, in one of the 40 rows round the player; only the rows the
+ * player can walk to or look at count. A nectar may turn into an idle
+ * root. */
+double window_error_bound(const struct bilebio *bb, int turns)
+{
+    const double p = (bb->active_threshold[TILE_ROOT] + 1.0) / 4294967296.0;
+    const double near = (2 * (turns + 3) + 1) / 40.0;
+    const struct tile *t;
+    double bound = 0;
+    int x, y, d, dy;
+
+    for (y = 0; y < STAGE_HEIGHT; ++y) {
+        for (x = 0; x < STAGE_WIDTH; ++x) {
+            t = &STAGE(bb, x, y);
+            if (t->type != TILE_ROOT && t->type != TILE_NECTAR)
+                continue;
+            d = abs(x - bb->player_x);
+            dy = abs(y - bb->player_y);
+            if (dy > d)
+                d = dy;
+            if (d > WINDOW_RADIUS(1))
+                bound += ((t->type == TILE_ROOT && t->active) + turns * p) / 5 * (near < 1 ? near : 1);
+        }
+    }
+    return bound < 1 ? bound : 1;
+}
+
+/* Puts t, whose born holds its age, on the stage at c. */
+static void place_tile(struct bilebio *bb, int c, struct tile t)
+{
+    t.born = next_visit(bb, c) - t.born;
+    bb->grid[c] = t;
+    if (bb->engine == ENGINE_EVENTS) {
+        schedule_activation(bb, c, bb->stage_age + 1);
+        schedule_expiry(bb, c);
+    }
+}
+
+/* Takes the tile at c off the stage, keeping its age in born. */
+static struct tile lift_tile(struct bilebio *bb, int c)
+{
+    struct tile t = bb->grid[c];
+    t.born = next_visit(bb, c) - t.born;
+    return t;
+}
+
+void set_rules(struct bilebio *bb, const struct rules *rules)
+{
+    bb->rules = *rules;
+    set_activation_thresholds(bb);
+}
+
+const struct tile stages[][STAGE_HEIGHT][STAGE_WIDTH] = {
 #include "stages.inc"
 };
 
+#define NUM_STAGES (sizeof(stages) / sizeof(stages[0]))
+
+/* Where set_stage() draws its layouts from; see set_stage_pack(). */
+static const struct tile (*stage_pack)[STAGE_HEIGHT][STAGE_WIDTH] = stages;
+static unsigned long stage_pack_size = NUM_STAGES;
+
+void set_stage_pack(const struct tile (*pack)[STAGE_HEIGHT][STAGE_WIDTH], unsigned long n)
+{
+    if (pack && n) {
+        stage_pack = pack;
+        stage_pack_size = n;
+    }
+    else {
+        stage_pack = stages;
+        stage_pack_size = NUM_STAGES;
+    }
+}
+
+/* Copies layout onto the stage and walls it in with sentinels. */
+void load_stage(struct bilebio *bb, const struct tile (*layout)[STAGE_WIDTH])
+{
+    const struct tile sentinel = make_tile(TILE_SENTINEL);
+    int c, y;
+
+    for (c = 0; c < GRID_CELLS; ++c)
+        bb->grid[c] = sentinel;
+    for (y = 0; y < STAGE_HEIGHT; ++y)
+        memcpy(&STAGE(bb, 0, y), layout[y], sizeof(layout[y]));
+}
+
+/* A name for a layout that does not depend on the pack it came from: a
+ * hash of its tile types, never 0. */
+unsigned long layout_template(const struct tile (*layout)[STAGE_WIDTH])
+{
+    unsigned long h = 0;
+    int x, y;
+
+    for (y = 0; y < STAGE_HEIGHT; ++y)
+        for (x = 0; x < STAGE_WIDTH; ++x)
+            h = mix32(h ^ (layout[y][x].type + 1));
+    return h ? h : 1;
+}
+
 void set_stage(struct bilebio *bb)
 {
+    const struct tile (*layout)[STAGE_WIDTH];
     int x, y;
     int num_roots;
     int tries;
 
-    /* Clear the stage. */
-    memset(bb->stage, 0, sizeof(bb->stage));
+    PERF_COUNT(PERF_STAGE_RESETS);
+
     /* Select a stage. */
-    memcpy(bb->stage, stages[RANDINT(NUM_STAGES)], sizeof(bb->stage));
+    layout = stage_pack[RANDINT(bb, stage_pack_size)];
+    load_stage(bb, layout);
+    bb->stage_template = layout_template(layout);
 
     /* Find the player. */
     for (y = 0; y < STAGE_HEIGHT; ++y) {
         for (x = 0; x < STAGE_WIDTH; ++x) {
-            if (bb->stage[y][x].type == TILE_PLAYER) {
+            if (STAGE(bb, x, y).type == TILE_PLAYER) {
                 bb->player_x = x;
                 bb->player_y = y;
             }
@@ -167,12 +689,12 @@ void set_stage(struct bilebio *bb)
     while (num_roots-- > 0) {
         tries = 20;
         while (tries-- > 0) {
-            x = RANDINT(STAGE_WIDTH);
-            y = RANDINT(STAGE_HEIGHT);
-            if (bb->stage[y][x].type == TILE_FLOOR) {
-                bb->stage[y][x] = TILE_FRESH_ROOT();
-                if (ONEIN(100 / bb->stage_level))
-                    bb->stage[y][x].active = 1;
+            x = RANDINT(bb, STAGE_WIDTH);
+            y = RANDINT(bb, STAGE_HEIGHT);
+            if (STAGE(bb, x, y).type == TILE_FLOOR) {
+                STAGE(bb, x, y) = TILE_FRESH_ROOT();
+                if (ONEIN(bb, 100 / bb->stage_level))
+                    STAGE(bb, x, y).active = 1;
                 break;
             }
         }
@@ -181,32 +703,60 @@ void set_stage(struct bilebio *bb)
     bb->num_nectars_placed = 0;
     bb->under_player = make_tile(TILE_FLOOR);
     bb->stage_age = 0;
+    set_activation_thresholds(bb);
 }
 
+#if !defined(RUN_BORG) && !defined(BILEBIO_LIB)
+/* Sets up the hint borg the first time hints are turned on. */
+static int start_hints(const struct bilebio *bb)
+{
+    if (ponder)
+        return 1;
+    if (!initialize_borg(&hint_borg, &hint_position, NULL))
+        return 0;
+    hint_borg.crisis_file = NULL;
+    borg_seed(&hint_borg, bb->rng);
+    if (!(ponder = ponder_new(&hint_borg)))
+        quit_borg(&hint_borg);
+    return ponder != NULL;
+}
+
+/* Shows where plants can grow next turn (reversed) and the turn after
+ * (underlined), and the borg's move. */
+static void show_hint(const struct bilebio *bb, int key)
+{
+    int x, y, d;
+
+    for (y = 0; y < STAGE_HEIGHT; ++y) {
+        for (x = 0; x < STAGE_WIDTH; ++x) {
+            d = hint_borg.danger[CELL(x, y)];
+            if (d)
+                mvaddch(y, x, tile_display(STAGE(bb, x, y)) | (d == 1 ? A_REVERSE : A_UNDERLINE));
+        }
+    }
+    if (hint_borg.pending_key)
+        set_status(3, GREEN, "Hint: %s (%c), then %c", ability_names[key - '0'], key, hint_borg.pending_key);
+    else
+        set_status(3, GREEN, "Hint: %c", key);
+    refresh();
+}
+#endif
+
 enum status update_bilebio(struct bilebio *bb)
 {
     int ch;
-    int x, y, rx, ry, r;
-    struct tile *tile;
-    int tries;
-    int successful_move = 0;
-    struct tile temp_stage[STAGE_HEIGHT][STAGE_WIDTH];
-    int knight_pattern[8][2] = {
-        {-2, -1},
-        { 2, -1},
-        {-2,  1},
-        { 2,  1},
-
-        {-1, -2},
-        {-1,  2},
-        { 1, -2},
-        { 1,  2},
-    };
+    int x, y, rx, r;
+
+#ifdef RUN_BORG
+    /* The borg thinks while the screen is drawn. */
+    if (ponder)
+        ponder_start(ponder, bb, 0);
+#endif
 
     /* Draw the stage. */
     for (y = 0; y < STAGE_HEIGHT; ++y)
         for (x = 0; x < STAGE_WIDTH; ++x)
-            mvaddch(y, x, tile_display(bb->stage[y][x]));
+            mvaddch(y, x, tile_display(STAGE(bb, x, y)));
 
     /* Draw the statuses. */
     set_status(0, WHITE, "Stage: %d Score: %d Energy: %d",
@@ -218,13 +768,13 @@ enum status update_bilebio(struct bilebio *bb)
         set_status(1, WHITE, "%d. %s (%d to use)",
                    bb->selected_ability,
                    ability_names[bb->selected_ability],
-                   ability_costs[bb->selected_ability].recurring);
+                   bb->rules.ability_costs[bb->selected_ability].recurring);
     }
     else {
         set_status(1, RED, "%d. %s (%d to learn)",
                    bb->selected_ability,
                    ability_names[bb->selected_ability],
-                   ability_costs[bb->selected_ability].initial);
+                   bb->rules.ability_costs[bb->selected_ability].initial);
     }
     rx = 0; /* Sum. Lol, reuse variables. */
     for (r = 1; r < NUM_ABILITIES; ++r)
@@ -232,255 +782,145 @@ enum status update_bilebio(struct bilebio *bb)
     set_status(2, BLUE, rx < 3 ? "%d abilities to learn" : "Can't learn any more", 3 - rx);
 
 #ifdef RUN_BORG
-    ch = borg_move();
     refresh();
+    ch = ponder ? ponder_wait(ponder) : borg_move(&borg);
 #else
-    ch = getch();
-#endif
-
-    switch (ch) {
-    case 'Q': return 0;
-    case 'h': case KEY_LEFT: successful_move = use_ability(bb, -1, 0); break;
-    case 'j': case KEY_DOWN: successful_move = use_ability(bb, 0, 1); break;
-    case 'k': case KEY_UP: successful_move = use_ability(bb, 0, -1); break;
-    case 'l': case KEY_RIGHT: successful_move = use_ability(bb, 1, 0); break;
-    case 'y': case KEY_A1: successful_move = use_ability(bb, -1, -1); break;
-    case 'u': case KEY_A3: successful_move = use_ability(bb, 1, -1); break;
-    case 'b': case KEY_C1: successful_move = use_ability(bb, -1, 1); break;
-    case 'n': case KEY_C3: successful_move = use_ability(bb, 1, 1); break;
-    case '.': case KEY_B2: successful_move = use_ability(bb, 0, 0); break;
-    case '0':
-        /* Fall through. */
-    case '1':
-        /* Fall through. */
-    case '2':
-        /* Fall through. */
-    case '3':
-        /* Fall through. */
-    case '4':
-        /* Fall through. */
-    case '5':
-        /* Fall through. */
-    case '6':
-        /* Fall through. */
-    case '7':
-        /* Fall through. */
-    case '8':
-        /* Fall through. */
-    case '9':
-        bb->selected_ability = ch - '0';
-        break;
-    case ' ':
-        rx = 0; /* Sum. Lol, reuse variables. */
-        for (r = 1; r < NUM_ABILITIES; ++r)
-            rx += bb->abilities[r];
-        if (rx < 3 &&
-            bb->player_energy >= ability_costs[bb->selected_ability].initial &&
-            !bb->abilities[bb->selected_ability]) {
-            /* Check prerequisites. */
-            if ((bb->selected_ability == 2 ||
-                bb->selected_ability == 3 ||
-                bb->selected_ability == 5 ||
-                bb->selected_ability == 6 ||
-                bb->selected_ability == 8 ||
-                bb->selected_ability == 9) &&
-                bb->abilities[bb->selected_ability - 1]) {
-
-                bb->player_energy -= ability_costs[bb->selected_ability].initial;
-                bb->abilities[bb->selected_ability] = 1;
-            }
-            else if ((bb->selected_ability == 1 ||
-                     bb->selected_ability == 4 ||
-                     bb->selected_ability == 7)) {
-                bb->player_energy -= ability_costs[bb->selected_ability].initial;
-                bb->abilities[bb->selected_ability] = 1;
-            }
-        }
-        break;
-    default: break;
+#ifndef BILEBIO_LIB
+    if (hints) {
+        ponder_wait(ponder);
+        copy_bilebio(&hint_position, bb);
+        hint_position.selected_ability = ABILITY_MOVE;
+        hint_borg.pending_key = 0;
+        ponder_start(ponder, &hint_position, PONDER_DANGER);
+        timeout(HINT_POLL_MS);
     }
-
-    if (successful_move) {
-        /* Update the plants. */
-        memcpy(temp_stage, bb->stage, sizeof(bb->stage));
-        for (y = 0; y < STAGE_HEIGHT; ++y) {
-            for (x = 0; x < STAGE_WIDTH; ++x) {
-                tile = &bb->stage[y][x];
-                /* We check from temp_stage, rather than bb->stage because
-                 * bb->stage will change, and we don't want the new guys
-                 * growing. */
-                switch (temp_stage[y][x].type) {
-                case TILE_ROOT:
-                    if (tile->active) {
-                        if (ONEIN(5)) {
-                            tries = 10;
-                            do {
-                                /* Prefer places close to the player. */
-                                rx = bb->player_x + RANDINT(10) - 5;
-                                ry = bb->player_y + RANDINT(40) - 20;
-                            } while (!try_to_place(bb, 0, &tries, rx, ry, TILE_FRESH_ROOT()));
-                        }
-                        else {
-                            try_to_place(bb, 1, NULL, x - 2, y, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x - 1, y, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x + 1, y, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x + 2, y, TILE_FRESH_VINE());
-
-
-                            try_to_place(bb, 1, NULL, x, y - 2, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x, y - 1, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x, y + 1, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x, y + 2, TILE_FRESH_VINE());
-
-
-                            try_to_place(bb, 1, NULL, x + 1, y + 1, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x - 1, y - 1, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x - 1, y + 1, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x + 1, y - 1, TILE_FRESH_VINE());
-                        }
-                        tile->active = 0;
-                    }
-                    else
-                        if (ACTIVE_CHANCE(ROOT_ACTIVE_BASE, bb->stage_level))
-                            tile->active = 1;
-                    break;
-                case TILE_FLOWER:
-                    if (tile->active) {
-                        if (ONEIN(4)) {
-                            r = RANDINT(8);
-                            rx = x + knight_pattern[r][0];
-                            ry = y + knight_pattern[r][1];
-                            try_to_place(bb, 1, NULL, rx, ry, TILE_FRESH_VINE());
-                        }
-                        else {
-                            r = RANDINT(8);
-                            rx = x + knight_pattern[r][0];
-                            ry = y + knight_pattern[r][1];
-                            try_to_place(bb, 1, NULL, rx, ry, TILE_FRESH_FLOWER());
-                            /* Only placing another flower uses a growth. */
-                            tile->growth--;
-                        }
-
-                        tile->active = 0;
-                    }
-                    else
-                        /* Cannot activate when stale. */
-                        if (ACTIVE_CHANCE(FLOWER_ACTIVE_BASE, bb->stage_level) && tile->growth > 0)
-                            tile->active = 1;
-                    break;
-                case TILE_VINE:
-                    if (tile->active) {
-                        rx = x + RANDINT(3) - 1;
-                        ry = y + RANDINT(3) - 1;
-                        try_to_place(bb, 1, NULL, rx, ry, TILE_FRESH_VINE());
-                        tile->growth--;
-                        tile->active = 0;
-                    }
-                    else
-                        /* Cannot activate when stale. */
-                        if (ACTIVE_CHANCE(VINE_ACTIVE_BASE, bb->stage_level) && tile->growth > 0)
-                            tile->active = 1;
-                    break;
-                default: break;
-                }
-                age_tile(bb, tile);
-            }
+    while ((ch = getch()) == ERR) {
+        if (hints && ponder_ready(ponder)) {
+            show_hint(bb, ponder_wait(ponder));
+            timeout(-1);
         }
-
-        /* Update random map stuff... like nectar! */
-        if (ONEIN(160) && bb->num_nectars_placed++ < 10) {
-            tries = 10;
-            while (tries-- > 0) {
-                rx = RANDINT(STAGE_WIDTH);
-                ry = RANDINT(STAGE_HEIGHT);
-                if (IN_STAGE(rx, ry) &&
-                    (bb->stage[y][x].type == TILE_FLOOR ||
-                    TILE_IS_PLANT(bb->stage[y][x]))) {
-                    bb->stage[y][x] = TILE_FRESH_NECTAR();
-                }
-            }
-        }
-
-        bb->stage_age++;
     }
+    if (ch == 'H') {
+        if (!hints && !start_hints(bb))
+            set_status(3, RED, "Could not start the hint thread!");
+        else if ((hints = !hints))
+            set_status(3, GREEN, "Hints on.");
+        else
+            set_status(3, BLUE, "Hints off.");
+        timeout(-1);
+        return STATUS_ALIVE;
+    }
+#else
+    ch = getch();
+#endif
+    if (ch == 'S') {
+        if (save_bilebio(bb, SAVE_FILE))
+            set_status(3, BLUE, "Saved to %s.", SAVE_FILE);
+        else
+            set_status(3, RED, "Could not save to %s!", SAVE_FILE);
+        return STATUS_ALIVE;
+    }
+#endif
 
-    if (bb->player_dead)
-        return STATUS_DEAD;
-
-    return STATUS_ALIVE;
+    return simulate_bilebio(bb, ch);
 }
 
+/* Ages the tile in this turn's visit of its cell. Its age is worked out
+ * from the turn it was born on, so it is only due a visit on the turns
+ * something happens to it (see schedule_expiry()). */
 void age_tile(struct bilebio *bb, struct tile *t)
 {
-    (void)bb;
+    const struct rules *rules = &bb->rules;
+    const unsigned long age = bb->stage_age + 1 - t->born;
     if (t->type == TILE_ROOT) {
-        t->age++;
-        if (t->age >= 200)
+        if (age >= rules->root_lifespan)
             t->dead = 1;
-        if (t->age >= 201)
+        if (age >= rules->root_lifespan + 1)
             *t = make_tile(TILE_FLOOR);
     }
     else if (t->type == TILE_FLOWER) {
-        t->age++;
-        if (t->age >= 40)
+        if (age >= rules->flower_lifespan)
             t->dead = 1;
-        if (t->age >= 41)
+        if (age >= rules->flower_lifespan + 1)
             *t = make_tile(TILE_FLOOR);
     }
     else if (t->type == TILE_VINE) {
-        t->age++;
-        if (t->age >= 40)
+        if (age >= rules->vine_lifespan)
             t->dead = 1;
-        if (t->age >= 41)
+        if (age >= rules->vine_lifespan + 1)
             *t = make_tile(TILE_FLOOR);
     }
     else if (t->type == TILE_NECTAR) {
-        t->age++;
-        if (((t->age + 1) % 40) == 0)
+        if (((age + 1) % rules->nectar_half_life) == 0)
             t->growth = t->growth / 2;
-        if (t->growth <= 1)
+        if (t->growth <= 1) {
             *t = TILE_FRESH_ROOT();
+            t->born = bb->stage_age + 1;
+        }
     }
     else if (t->type == TILE_REPELLENT) {
-        t->age++;
-        if (t->age >= TILE_REPELLENT_LIFESPAN)
+        if (age >= rules->repellent_lifespan)
             *t = make_tile(TILE_FLOOR);
     }
 }
 
+/* The age of a tile on the stage between turns; 0 for those that do not
+ * age. */
+unsigned long tile_age(const struct bilebio *bb, const struct tile *t)
+{
+    switch (t->type) {
+    case TILE_REPELLENT: case TILE_ROOT: case TILE_FLOWER: case TILE_VINE: case TILE_NECTAR:
+        return bb->stage_age - t->born;
+    default:
+        return 0;
+    }
+}
+
 int is_obstructed(struct bilebio *bb, int x, int y)
 {
     if (!IN_STAGE(x, y))
         return 1;
 
-    if (bb->stage[y][x].type != TILE_FLOOR &&
-        bb->stage[y][x].type != TILE_REPELLENT &&
-        bb->stage[y][x].type != TILE_EXIT &&
-        bb->stage[y][x].type != TILE_NECTAR &&
-        bb->stage[y][x].type != TILE_PLAYER &&
-        bb->stage[y][x].type != TILE_VINE &&
-        bb->stage[y][x].type != TILE_FLOWER)
+    return cell_obstructed(bb, CELL(x, y));
+}
+
+/* is_obstructed() for a grid cell, border included. */
+int cell_obstructed(const struct bilebio *bb, int c)
+{
+    const unsigned long type = bb->grid[c].type;
+
+    if (type != TILE_FLOOR &&
+        type != TILE_REPELLENT &&
+        type != TILE_EXIT &&
+        type != TILE_NECTAR &&
+        type != TILE_PLAYER &&
+        type != TILE_VINE &&
+        type != TILE_FLOWER)
         return 1;
 
     return 0;
 }
 
-int move_player(struct bilebio *bb, int x, int y)
+/* move_player() to grid cell c. */
+static int move_to(struct bilebio *bb, int c)
 {
-    if (is_obstructed(bb, x, y))
+    struct tile *t;
+
+    if (cell_obstructed(bb, c))
         return 0; /* Unsuccessful move. (Don't update) */
 
-    if (bb->stage[y][x].type == TILE_NECTAR) {
+    t = &bb->grid[c];
+    if (t->type == TILE_NECTAR) {
         /* Increase score. */
-        bb->player_score += bb->stage[y][x].growth * 8;
+        bb->player_score += t->growth * 8;
         /* Add energy. */
         if (bb->abilities[ABILITY_ENERGY])
-            bb->player_energy += bb->stage[y][x].growth * 3;
+            bb->player_energy += t->growth * 3;
         else
-            bb->player_energy += bb->stage[y][x].growth;
-        bb->stage[y][x] = make_tile(TILE_FLOOR);
+            bb->player_energy += t->growth;
+        *t = make_tile(TILE_FLOOR);
     }
-    else if (bb->stage[y][x].type == TILE_EXIT) {
+    else if (t->type == TILE_EXIT) {
         bb->player_score += bb->stage_level * 100;
         bb->stage_level++;
 
@@ -496,86 +936,90 @@ int move_player(struct bilebio *bb, int x, int y)
         set_stage(bb);
         return 0; /* Unsuccessful move. (Don't update) */
     }
-    else if (bb->stage[y][x].type == TILE_VINE ||
-             bb->stage[y][x].type == TILE_FLOWER) {
+    else if (t->type == TILE_VINE ||
+             t->type == TILE_FLOWER) {
         /* 50% chance of success. */
-        if (ONEIN(2))
-            bb->stage[y][x] = make_tile(TILE_FLOOR);
+        if (ONEIN(bb, 2))
+            *t = make_tile(TILE_FLOOR);
         else
             return 1; /* Don't move but still update. */
     }
-    else if (bb->stage[y][x].type == TILE_PLAYER) {
+    else if (t->type == TILE_PLAYER) {
         return 1;
     }
 
-    bb->stage[bb->player_y][bb->player_x] = bb->under_player;
-    bb->player_x = x;
-    bb->player_y = y;
-    bb->under_player = bb->stage[bb->player_y][bb->player_x];
-    bb->stage[bb->player_y][bb->player_x] = make_tile(TILE_PLAYER);
+    place_tile(bb, CELL(bb->player_x, bb->player_y), bb->under_player);
+    bb->player_x = CELL_X(c);
+    bb->player_y = CELL_Y(c);
+    bb->under_player = lift_tile(bb, c);
+    *t = make_tile(TILE_PLAYER);
     return 1;
 }
 
+int move_player(struct bilebio *bb, int x, int y)
+{
+    if (!IN_STAGE(x, y))
+        return 0;
+
+    return move_to(bb, CELL(x, y));
+}
+
+/* dx, dy is a step to a neighbouring cell (or none), so the cells the
+ * abilities look at, up to two steps away, are all on the grid. */
 int use_ability(struct bilebio *bb, int dx, int dy)
 {
-    int x, y;
+    const int p = CELL(bb->player_x, bb->player_y), d = dy * GRID_WIDTH + dx;
+    int i;
 
     switch (bb->selected_ability) {
     /* ABILITY_MOVE covered by default. */
 
     case ABILITY_DASH:
-        if (bb->abilities[ABILITY_DASH] && bb->player_energy >= ability_costs[ABILITY_DASH].recurring) {
+        if (bb->abilities[ABILITY_DASH] && bb->player_energy >= bb->rules.ability_costs[ABILITY_DASH].recurring) {
             if (!is_obstructed(bb, bb->player_x + (dx * 1), bb->player_y + (dy * 1)))
             if (!is_obstructed(bb, bb->player_x + (dx * 2), bb->player_y + (dy * 2)))
             if (!is_obstructed(bb, bb->player_x + (dx * 3), bb->player_y + (dy * 3)))
             if (!is_obstructed(bb, bb->player_x + (dx * 4), bb->player_y + (dy * 4))) {
-                bb->player_energy -= ability_costs[ABILITY_DASH].recurring;
+                bb->player_energy -= bb->rules.ability_costs[ABILITY_DASH].recurring;
                 return move_player(bb, bb->player_x + (dx * 4), bb->player_y + (dy * 4));
             }
         }
         return move_player(bb, bb->player_x + dx, bb->player_y + dy);
 
     case ABILITY_PLANT_HOP:
-        if (bb->abilities[ABILITY_PLANT_HOP] && bb->player_energy >= ability_costs[ABILITY_PLANT_HOP].recurring) {
-            if (IN_STAGE(bb->player_x + dx, bb->player_y + dy) &&
-                TILE_IS_PLANT(bb->stage[bb->player_y + dy][bb->player_x + dx]) &&
-                !is_obstructed(bb, bb->player_x + (dx * 2), bb->player_y + (dy * 2))) {
-                bb->player_energy -= ability_costs[ABILITY_PLANT_HOP].recurring;
+        if (bb->abilities[ABILITY_PLANT_HOP] && bb->player_energy >= bb->rules.ability_costs[ABILITY_PLANT_HOP].recurring) {
+            if (TILE_IS_PLANT(bb->grid[p + d]) && !cell_obstructed(bb, p + 2 * d)) {
+                bb->player_energy -= bb->rules.ability_costs[ABILITY_PLANT_HOP].recurring;
                 return move_player(bb, bb->player_x + (dx * 2), bb->player_y + (dy * 2));
             }
         }
         return move_player(bb, bb->player_x + dx, bb->player_y + dy);
 
     case ABILITY_REPELLENT:
-        if (bb->abilities[ABILITY_REPELLENT] && bb->player_energy >= ability_costs[ABILITY_REPELLENT].recurring) {
-            for (y = -2; y <= 2; ++y) {
-                for (x = -2; x <= 2; ++x) {
-                    if (bb->stage[bb->player_y + y][bb->player_x + x].type == TILE_FLOOR)
-                        bb->stage[bb->player_y + y][bb->player_x + x] = make_tile(TILE_REPELLENT);
-                }
-            }
+        if (bb->abilities[ABILITY_REPELLENT] && bb->player_energy >= bb->rules.ability_costs[ABILITY_REPELLENT].recurring) {
+            /* The border keeps it on the stage. */
+            for (i = 0; i < 24; ++i)
+                if (bb->grid[p + window_offsets[i].d].type == TILE_FLOOR)
+                    place_tile(bb, p + window_offsets[i].d, make_tile(TILE_REPELLENT));
             return 1;
         }
         return move_player(bb, bb->player_x + dx, bb->player_y + dy);
 
     case ABILITY_ATTACK:
-        if (bb->abilities[ABILITY_ATTACK] && bb->player_energy >= ability_costs[ABILITY_ATTACK].recurring) {
-            if (IN_STAGE(bb->player_x + dx, bb->player_y + dy) &&
-                TILE_IS_PLANT(bb->stage[bb->player_y + dy][bb->player_x + dx]) &&
+        if (bb->abilities[ABILITY_ATTACK] && bb->player_energy >= bb->rules.ability_costs[ABILITY_ATTACK].recurring) {
+            if (TILE_IS_PLANT(bb->grid[p + d]) &&
                 /* Can't attack roots. */
-                bb->stage[bb->player_y + dy][bb->player_x + dx].type != TILE_ROOT) {
-                bb->player_energy -= ability_costs[ABILITY_ATTACK].recurring;
-                bb->stage[bb->player_y + dy][bb->player_x + dx] = make_tile(TILE_FLOOR);
+                bb->grid[p + d].type != TILE_ROOT) {
+                bb->player_energy -= bb->rules.ability_costs[ABILITY_ATTACK].recurring;
+                bb->grid[p + d] = make_tile(TILE_FLOOR);
             }
         }
         return move_player(bb, bb->player_x + dx, bb->player_y + dy);
 
     case ABILITY_WALL_HOP:
-        if (bb->abilities[ABILITY_WALL_HOP] && bb->player_energy >= ability_costs[ABILITY_WALL_HOP].recurring) {
-            if (IN_STAGE(bb->player_x + dx, bb->player_y + dy) &&
-                bb->stage[bb->player_y + dy][bb->player_x + dx].type == TILE_WALL &&
-                !is_obstructed(bb, bb->player_x + (dx * 2), bb->player_y + (dy * 2))) {
-                bb->player_energy -= ability_costs[ABILITY_WALL_HOP].recurring;
+        if (bb->abilities[ABILITY_WALL_HOP] && bb->player_energy >= bb->rules.ability_costs[ABILITY_WALL_HOP].recurring) {
+            if (bb->grid[p + d].type == TILE_WALL && !cell_obstructed(bb, p + 2 * d)) {
+                bb->player_energy -= bb->rules.ability_costs[ABILITY_WALL_HOP].recurring;
                 return move_player(bb, bb->player_x + (dx * 2), bb->player_y + (dy * 2));
             }
         }
@@ -584,28 +1028,25 @@ int use_ability(struct bilebio *bb, int dx, int dy)
     /* ABILITY_LIFE isn't used. */
 
     case ABILITY_WALL_WALK:
-        if (bb->abilities[ABILITY_WALL_WALK] && bb->player_energy >= ability_costs[ABILITY_WALL_WALK].recurring) {
-            if (IN_STAGE(bb->player_x + dx, bb->player_y + dy) &&
-                bb->stage[bb->player_y + dy][bb->player_x + dx].type == TILE_WALL) {
-                bb->player_energy -= ability_costs[ABILITY_WALL_WALK].recurring;
+        if (bb->abilities[ABILITY_WALL_WALK] && bb->player_energy >= bb->rules.ability_costs[ABILITY_WALL_WALK].recurring) {
+            if (bb->grid[p + d].type == TILE_WALL) {
+                bb->player_energy -= bb->rules.ability_costs[ABILITY_WALL_WALK].recurring;
 
-                bb->stage[bb->player_y][bb->player_x] = bb->under_player;
+                place_tile(bb, p, bb->under_player);
                 bb->player_x += dx;
                 bb->player_y += dy;
-                bb->under_player = bb->stage[bb->player_y][bb->player_x];
-                bb->stage[bb->player_y][bb->player_x] = make_tile(TILE_PLAYER);
+                bb->under_player = lift_tile(bb, p + d);
+                bb->grid[p + d] = make_tile(TILE_PLAYER);
                 return 1;
             }
             /* Can't let the player just stand in a wall forever. */
-            else if (IN_STAGE(bb->player_x + dx, bb->player_y + dy) &&
-                     bb->stage[bb->player_y + dy][bb->player_x + dx].type == TILE_PLAYER) {
+            else if (bb->grid[p + d].type == TILE_PLAYER) {
                 return 0;
             }
         }
         /* Can't let the player just stand in a wall forever. */
-        else if (bb->player_energy < ability_costs[ABILITY_WALL_WALK].recurring &&
-                 IN_STAGE(bb->player_x + dx, bb->player_y + dy) &&
-                 bb->stage[bb->player_y + dy][bb->player_x + dx].type == TILE_PLAYER) {
+        else if (bb->player_energy < bb->rules.ability_costs[ABILITY_WALL_WALK].recurring &&
+                 bb->grid[p + d].type == TILE_PLAYER) {
             return 0;
         }
         return move_player(bb, bb->player_x + dx, bb->player_y + dy);
@@ -613,12 +1054,11 @@ int use_ability(struct bilebio *bb, int dx, int dy)
     /* ABILITY_ENERGY isn't used. */
 
     case ABILITY_SPAWN_WALL:
-        if (bb->abilities[ABILITY_SPAWN_WALL] && bb->player_energy >= ability_costs[ABILITY_SPAWN_WALL].recurring) {
-            if (IN_STAGE(bb->player_x + dx, bb->player_y + dy) &&
-                bb->stage[bb->player_y + dy][bb->player_x + dx].type == TILE_FLOOR) {
-                bb->player_energy -= ability_costs[ABILITY_SPAWN_WALL].recurring;
+        if (bb->abilities[ABILITY_SPAWN_WALL] && bb->player_energy >= bb->rules.ability_costs[ABILITY_SPAWN_WALL].recurring) {
+            if (bb->grid[p + d].type == TILE_FLOOR) {
+                bb->player_energy -= bb->rules.ability_costs[ABILITY_SPAWN_WALL].recurring;
 
-                bb->stage[bb->player_y + dy][bb->player_x + dx] = make_tile(TILE_WALL);
+                bb->grid[p + d] = make_tile(TILE_WALL);
                 return 1;
             }
         }
@@ -629,25 +1069,9 @@ int use_ability(struct bilebio *bb, int dx, int dy)
     }
 }
 
-int try_to_place(struct bilebio *bb, int deadly, int *tries, int x, int y, struct tile t)
+/* After a failed placement. */
+static int out_of_tries(int *tries)
 {
-    if (IN_STAGE(x, y)) {
-        if (deadly && bb->stage[y][x].type == TILE_PLAYER) {
-            if (bb->abilities[ABILITY_LIFE] && bb->player_energy >= ability_costs[ABILITY_LIFE].recurring) {
-                bb->player_energy -= ability_costs[ABILITY_LIFE].recurring;
-                return 1;
-            }
-            else {
-                bb->stage[y][x] = t;
-                bb->player_dead = true;
-                return 1; /* Break out. */
-            }
-        }
-        else if (bb->stage[y][x].type == TILE_FLOOR) {
-            bb->stage[y][x] = t;
-        }
-    }
-
     if (tries && (*tries)-- > 0)
         /* Failed, but break out. */
         return 1;
@@ -659,6 +1083,45 @@ int try_to_place(struct bilebio *bb, int deadly, int *tries, int x, int y, struc
     return 0;
 }
 
+/* Places t at cell c unless something is in the way; a deadly tile may
+ * land on the player. Returns 1 to stop trying. */
+static int place_at(struct bilebio *bb, int deadly, int *tries, int c, struct tile t)
+{
+    if (bb->grid[c].type == TILE_SENTINEL)
+        PERF_COUNT(PERF_PLACE_OFF_STAGE);
+    else if (deadly && bb->grid[c].type == TILE_PLAYER) {
+        if (bb->abilities[ABILITY_LIFE] && bb->player_energy >= bb->rules.ability_costs[ABILITY_LIFE].recurring) {
+            PERF_COUNT(PERF_PLACE_LIFE_SAVED);
+            bb->player_energy -= bb->rules.ability_costs[ABILITY_LIFE].recurring;
+            return 1;
+        }
+        else {
+            PERF_COUNT(PERF_PLACE_KILLED);
+            place_tile(bb, c, t);
+            bb->player_dead = true;
+            return 1; /* Break out. */
+        }
+    }
+    else if (bb->grid[c].type == TILE_FLOOR) {
+        PERF_COUNT(PERF_PLACE_PLANTED);
+        place_tile(bb, c, t);
+    }
+    else
+        PERF_COUNT(PERF_PLACE_OCCUPIED);
+
+    return out_of_tries(tries);
+}
+
+/* As place_at(), for any x, y: reaches past the border are off the stage. */
+int try_to_place(struct bilebio *bb, int deadly, int *tries, int x, int y, struct tile t)
+{
+    if (IN_STAGE(x, y))
+        return place_at(bb, deadly, tries, CELL(x, y), t);
+
+    PERF_COUNT(PERF_PLACE_OFF_STAGE);
+    return out_of_tries(tries);
+}
+
 void set_status(int row, chtype color, const char *fmt, ...)
 {
     va_list args;
@@ -678,25 +1141,223 @@ void set_status(int row, chtype color, const char *fmt, ...)
     attroff(color);
 }
 
-enum status simulate_bilebio(struct bilebio *bb, int move)
+/* The active plant at cell c grows, and goes idle. Its growth stays
+ * within the border, so only the root's seeding needs try_to_place().
+ * Growth is the only placing a turn's scan does, so the scan only marks
+ * its place in bb->scanned here rather than at every cell. */
+static void grow_plant(struct bilebio *bb, int c, struct tile *tile)
 {
-    int ch;
-    int x, y, rx, ry, r;
+    int rx, ry, i, tries;
+
+    bb->scanned = c + 1;
+
+    switch (tile->type) {
+    case TILE_ROOT:
+        if (ONEIN(bb, 5)) {
+            tries = 10;
+            do {
+                /* Prefer places close to the player. */
+                rx = bb->player_x + RANDINT(bb, 10) - 5;
+                ry = bb->player_y + RANDINT(bb, 40) - 20;
+            } while (!try_to_place(bb, 0, &tries, rx, ry, TILE_FRESH_ROOT()));
+        }
+        else {
+            for (i = 0; i < 12; ++i) {
+                if (i == 1 || i == 2 || i == 5 || i == 6)
+                    place_at(bb, 1, NULL, c + burst_offsets[i].d, TILE_FRESH_FLOWER());
+                else
+                    place_at(bb, 1, NULL, c + burst_offsets[i].d, TILE_FRESH_VINE());
+            }
+        }
+        break;
+    case TILE_FLOWER:
+        if (ONEIN(bb, 4)) {
+            i = RANDINT(bb, 8);
+            place_at(bb, 1, NULL, c + knight_offsets[i].d, TILE_FRESH_VINE());
+        }
+        else {
+            i = RANDINT(bb, 8);
+            place_at(bb, 1, NULL, c + knight_offsets[i].d, TILE_FRESH_FLOWER());
+            /* Only placing another flower uses a growth. */
+            tile->growth--;
+        }
+        break;
+    case TILE_VINE:
+        rx = RANDINT(bb, 3) - 1;
+        ry = RANDINT(bb, 3) - 1;
+        place_at(bb, 1, NULL, c + ry * GRID_WIDTH + rx, TILE_FRESH_VINE());
+        tile->growth--;
+        break;
+    }
+    tile->active = 0;
+}
+
+/* ENGINE_EVENTS' turn: the scan, but only over the cells with a plant to
+ * grow or a tile to age, in the same order. Cells are marked as things
+ * fall due, so the words are read afresh as they are walked. */
+static void visit_due(struct bilebio *bb)
+{
+    struct events *ev = &bb->events;
+    const unsigned int now = (unsigned int)bb->stage_age;
+    struct tile *tile;
+    unsigned int bits;
+    int c, w, next, fired;
+
+    for (c = ev->expiries.head[now % WHEEL_SLOTS]; c >= 0; c = next) {
+        next = ev->expiries.next[c];
+        if (ev->expiries.when[c] == now) {
+            unqueue(&ev->expiries, c);
+            mark_due(bb, c);
+        }
+    }
+    for (w = 0; w < DUE_WORDS; ++w) {
+        while ((bits = ev->due[w]) != 0) {
+            for (c = 0; !(bits & 1U << c); ++c)
+                ;
+            ev->due[w] &= ~(1U << c);
+            c += w * 32;
+            tile = &bb->grid[c];
+            bb->scanned = c + 1;
+            PERF_COUNT(PERF_TILES_SCANNED);
+            fired = TILE_IS_PLANT(*tile) && tile->active;
+            if (fired)
+                grow_plant(bb, c, tile);
+            age_tile(bb, tile);
+            /* The tile may have died or turned into a root; plants idle
+             * again after growing. */
+            if (ev->expiries.prev[c] == OFF_WHEEL)
+                schedule_expiry(bb, c);
+            if (fired || ev->activations.prev[c] == OFF_WHEEL)
+                schedule_activation(bb, c, bb->stage_age + 1);
+        }
+    }
+}
+
+/* The plants' and the stage's part of a turn the player acted in. */
+static void play_turn(struct bilebio *bb)
+{
+    int x, y, c, r, rx, ry, x0, x1, y0, y1;
     struct tile *tile;
     int tries;
+    struct tile temp_stage[GRID_CELLS];
+    unsigned int base;
+
+    TRACE_BEGIN("turn");
+    PERF_COUNT(PERF_TURNS);
+
+    /* Update the plants. */
+    if (bb->engine == ENGINE_EVENTS) {
+        visit_due(bb);
+        wake_plants(bb);
+    }
+    else {
+        x0 = y0 = 0;
+        x1 = STAGE_WIDTH - 1;
+        y1 = STAGE_HEIGHT - 1;
+        if (bb->horizon > 0) {
+            r = WINDOW_RADIUS(bb->horizon--);
+            if (bb->player_x - r > x0)
+                x0 = bb->player_x - r;
+            if (bb->player_x + r < x1)
+                x1 = bb->player_x + r;
+            if (bb->player_y - r > y0)
+                y0 = bb->player_y - r;
+            if (bb->player_y + r < y1)
+                y1 = bb->player_y + r;
+        }
+        PERF_ADD(PERF_TILES_SCANNED, (x1 - x0 + 1) * (y1 - y0 + 1));
+        memcpy(&temp_stage[CELL(0, y0)], &bb->grid[CELL(0, y0)],
+               (CELL(0, y1 + 1) - CELL(0, y0)) * sizeof(bb->grid[0]));
+        base = (unsigned int)activation_base(bb);
+        for (y = y0; y <= y1; ++y) {
+            for (x = x0; x <= x1; ++x) {
+                c = CELL(x, y);
+                tile = &bb->grid[c];
+                /* We check from temp_stage, rather than bb->grid because
+                 * bb->grid will change, and we don't want the new guys
+                 * growing. */
+                switch (temp_stage[c].type) {
+                case TILE_ROOT:
+                    if (tile->active)
+                        grow_plant(bb, c, tile);
+                    else
+                        if (ACTIVE(bb, activation_word(bb, base, x, y), TILE_ROOT)) {
+                            tile->active = 1;
+                            PERF_COUNT(PERF_ACTIVATE_ROOT);
+                        }
+                    break;
+                case TILE_FLOWER:
+                    if (tile->active)
+                        grow_plant(bb, c, tile);
+                    else
+                        /* Cannot activate when stale. */
+                        if (tile->growth > 0 && ACTIVE(bb, activation_word(bb, base, x, y), TILE_FLOWER)) {
+                            tile->active = 1;
+                            PERF_COUNT(PERF_ACTIVATE_FLOWER);
+                        }
+                    break;
+                case TILE_VINE:
+                    if (tile->active)
+                        grow_plant(bb, c, tile);
+                    else
+                        /* Cannot activate when stale. */
+                        if (tile->growth > 0 && ACTIVE(bb, activation_word(bb, base, x, y), TILE_VINE)) {
+                            tile->active = 1;
+                            PERF_COUNT(PERF_ACTIVATE_VINE);
+                        }
+                    break;
+                default: break;
+                }
+                if (TILE_AGES(*tile))
+                    age_tile(bb, tile);
+            }
+        }
+    }
+    bb->scanned = GRID_CELLS;
+
+    /* Update random map stuff... like nectar! */
+    if (ONEIN(bb, bb->rules.nectar_chance) && bb->num_nectars_placed++ < 10) {
+        tries = 10;
+        while (tries-- > 0) {
+            rx = RANDINT(bb, STAGE_WIDTH);
+            ry = RANDINT(bb, STAGE_HEIGHT);
+            if (STAGE(bb, rx, ry).type == TILE_FLOOR || TILE_IS_PLANT(STAGE(bb, rx, ry))) {
+                place_tile(bb, CELL(rx, ry), TILE_FRESH_NECTAR());
+                break;
+            }
+        }
+    }
+
+    bb->stage_age++;
+    bb->scanned = 0;
+    TRACE_END("turn");
+}
+
+/* simulate_bilebio() with the direction key for dx, dy (0, 0 to stay
+ * put), for callers that play nothing else: with the plain move selected
+ * the step goes straight to the grid, with no key or ability dispatch. */
+enum status step_bilebio(struct bilebio *bb, int dx, int dy)
+{
+    int moved;
+
+    if (bb->selected_ability == ABILITY_MOVE)
+        moved = move_to(bb, CELL(bb->player_x + dx, bb->player_y + dy));
+    else
+        moved = use_ability(bb, dx, dy);
+    if (moved)
+        play_turn(bb);
+
+    if (bb->player_dead)
+        return STATUS_DEAD;
+
+    return STATUS_ALIVE;
+}
+
+enum status simulate_bilebio(struct bilebio *bb, int move)
+{
+    int ch;
+    int rx, r;
     int successful_move = 0;
-    struct tile temp_stage[STAGE_HEIGHT][STAGE_WIDTH];
-    int knight_pattern[8][2] = {
-        {-2, -1},
-        { 2, -1},
-        {-2,  1},
-        { 2,  1},
-
-        {-1, -2},
-        {-1,  2},
-        { 1, -2},
-        { 1,  2},
-    };
 
     ch = move;
 
@@ -737,7 +1398,7 @@ enum status simulate_bilebio(struct bilebio *bb, int move)
         for (r = 1; r < NUM_ABILITIES; ++r)
             rx += bb->abilities[r];
         if (rx < 3 &&
-            bb->player_energy >= ability_costs[bb->selected_ability].initial &&
+            bb->player_energy >= bb->rules.ability_costs[bb->selected_ability].initial &&
             !bb->abilities[bb->selected_ability]) {
             /* Check prerequisites. */
             if ((bb->selected_ability == 2 ||
@@ -748,13 +1409,13 @@ enum status simulate_bilebio(struct bilebio *bb, int move)
                 bb->selected_ability == 9) &&
                 bb->abilities[bb->selected_ability - 1]) {
 
-                bb->player_energy -= ability_costs[bb->selected_ability].initial;
+                bb->player_energy -= bb->rules.ability_costs[bb->selected_ability].initial;
                 bb->abilities[bb->selected_ability] = 1;
             }
             else if ((bb->selected_ability == 1 ||
                      bb->selected_ability == 4 ||
                      bb->selected_ability == 7)) {
-                bb->player_energy -= ability_costs[bb->selected_ability].initial;
+                bb->player_energy -= bb->rules.ability_costs[bb->selected_ability].initial;
                 bb->abilities[bb->selected_ability] = 1;
             }
         }
@@ -762,109 +1423,8 @@ enum status simulate_bilebio(struct bilebio *bb, int move)
     default: break;
     }
 
-    if (successful_move) {
-        /* Update the plants. */
-        memcpy(temp_stage, bb->stage, sizeof(bb->stage));
-        for (y = 0; y < STAGE_HEIGHT; ++y) {
-            for (x = 0; x < STAGE_WIDTH; ++x) {
-                tile = &bb->stage[y][x];
-                /* We check from temp_stage, rather than bb->stage because
-                 * bb->stage will change, and we don't want the new guys
-                 * growing. */
-                switch (temp_stage[y][x].type) {
-                case TILE_ROOT:
-                    if (tile->active) {
-                        if (ONEIN(5)) {
-                            tries = 10;
-                            do {
-                                /* Prefer places close to the player. */
-                                rx = bb->player_x + RANDINT(10) - 5;
-                                ry = bb->player_y + RANDINT(40) - 20;
-                            } while (!try_to_place(bb, 0, &tries, rx, ry, TILE_FRESH_ROOT()));
-                        }
-                        else {
-                            try_to_place(bb, 1, NULL, x - 2, y, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x - 1, y, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x + 1, y, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x + 2, y, TILE_FRESH_VINE());
-
-
-                            try_to_place(bb, 1, NULL, x, y - 2, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x, y - 1, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x, y + 1, TILE_FRESH_FLOWER());
-                            try_to_place(bb, 1, NULL, x, y + 2, TILE_FRESH_VINE());
-
-
-                            try_to_place(bb, 1, NULL, x + 1, y + 1, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x - 1, y - 1, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x - 1, y + 1, TILE_FRESH_VINE());
-                            try_to_place(bb, 1, NULL, x + 1, y - 1, TILE_FRESH_VINE());
-                        }
-                        tile->active = 0;
-                    }
-                    else
-                        if (ACTIVE_CHANCE(ROOT_ACTIVE_BASE, bb->stage_level))
-                            tile->active = 1;
-                    break;
-                case TILE_FLOWER:
-                    if (tile->active) {
-                        if (ONEIN(4)) {
-                            r = RANDINT(8);
-                            rx = x + knight_pattern[r][0];
-                            ry = y + knight_pattern[r][1];
-                            try_to_place(bb, 1, NULL, rx, ry, TILE_FRESH_VINE());
-                        }
-                        else {
-                            r = RANDINT(8);
-                            rx = x + knight_pattern[r][0];
-                            ry = y + knight_pattern[r][1];
-                            try_to_place(bb, 1, NULL, rx, ry, TILE_FRESH_FLOWER());
-                            /* Only placing another flower uses a growth. */
-                            tile->growth--;
-                        }
-
-                        tile->active = 0;
-                    }
-                    else
-                        /* Cannot activate when stale. */
-                        if (ACTIVE_CHANCE(FLOWER_ACTIVE_BASE, bb->stage_level) && tile->growth > 0)
-                            tile->active = 1;
-                    break;
-                case TILE_VINE:
-                    if (tile->active) {
-                        rx = x + RANDINT(3) - 1;
-                        ry = y + RANDINT(3) - 1;
-                        try_to_place(bb, 1, NULL, rx, ry, TILE_FRESH_VINE());
-                        tile->growth--;
-                        tile->active = 0;
-                    }
-                    else
-                        /* Cannot activate when stale. */
-                        if (ACTIVE_CHANCE(VINE_ACTIVE_BASE, bb->stage_level) && tile->growth > 0)
-                            tile->active = 1;
-                    break;
-                default: break;
-                }
-                age_tile(bb, tile);
-            }
-        }
-
-        /* Update random map stuff... like nectar! */
-        if (ONEIN(160) && bb->num_nectars_placed++ < 10) {
-            tries = 10;
-            while (tries-- > 0) {
-                rx = RANDINT(STAGE_WIDTH);
-                ry = RANDINT(STAGE_HEIGHT);
-                if (IN_STAGE(rx, ry) &&
-                    (bb->stage[y][x].type == TILE_FLOOR ||
-                    TILE_IS_PLANT(bb->stage[y][x]))) {
-                    bb->stage[y][x] = TILE_FRESH_NECTAR();
-                }
-            }
-        }
-
-        bb->stage_age++;
-    }
+    if (successful_move)
+        play_turn(bb);
 
     if (bb->player_dead)
         return STATUS_DEAD;
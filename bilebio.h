@@ -5,10 +5,14 @@
 #include <curses.h>
 #include <math.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "perf.h"
+#include "trace.h"
+
 #define BLACK   COLOR_PAIR(COLOR_BLACK)
 #define BLUE    COLOR_PAIR(COLOR_BLUE)
 #define GREEN   COLOR_PAIR(COLOR_GREEN)
@@ -18,10 +22,10 @@
 #define YELLOW  COLOR_PAIR(COLOR_YELLOW)
 #define WHITE   COLOR_PAIR(COLOR_WHITE)
 
-/* [0-1) */
-#define RAND()      (rand() * 0.99999999 / RAND_MAX)
-#define RANDINT(n)  ((int)floor((RAND() * n)))
-#define ONEIN(n)    (RANDINT(n) == 0)
+/* [0-1), drawn from the game's own stream (see bilebio_rand()). */
+#define RAND(bb)        (bilebio_rand(bb) / 4294967296.0)
+#define RANDINT(bb, n)  ((int)floor((RAND(bb) * (n))))
+#define ONEIN(bb, n)    (RANDINT(bb, n) == 0)
 
 enum status {
     STATUS_QUIT,
@@ -37,14 +41,17 @@ enum status {
 #define TILE_IS_PLANT(t)    ((t).type == TILE_VINE ||   \
                              (t).type == TILE_FLOWER || \
                              (t).type == TILE_ROOT)
+/* Tiles age_tile() has work for. */
+#define TILE_AGES(t)        ((t).type == TILE_REPELLENT || TILE_IS_PLANT(t) || \
+                             (t).type == TILE_NECTAR)
 
-#define ROOT_ACTIVE_BASE        20
-#define FLOWER_ACTIVE_BASE      15
-#define VINE_ACTIVE_BASE        10
-/* Chance = (l+b-1) / (b^2), where b = base chance and l = stage level. */
-#define ACTIVE_CHANCE(base, level)   (ONEIN(((base)*(base))/((level)+(base)-1)))
-
-#define TILE_REPELLENT_LIFESPAN 10
+/* Chance = (l+b-1) / (b^2), where b = base chance and l = stage level.
+ * The draw is keyed on the cell and turn rather than taken from the game
+ * stream, so games sharing an activation seed see the same activations.
+ * word is the cell's 32-bit activation word (see activation_base()) and
+ * the thresholds are worked out once per level by
+ * set_activation_thresholds(), so the test is an integer compare. */
+#define ACTIVE(bb, word, type)  ((word) <= (bb)->active_threshold[type])
 
 enum {
     TILE_FLOOR,
@@ -56,13 +63,21 @@ enum {
     TILE_VINE,
     TILE_NECTAR,
     TILE_EXIT,
+    /* The border around the stage; see CELL(). */
+    TILE_SENTINEL,
     NUM_TILES
 };
 
+/* A tile on the stage was born on turn born, and is stage_age - born turns
+ * old (see tile_age()). Off the stage, fresh from make_plant() or under
+ * the player, where tiles do not age, born holds the age itself. Keeping
+ * the birth turn rather than a count lets ENGINE_EVENTS (bilebio-fork and
+ * bilebio-sweep -E) leave a tile unvisited until something happens to it;
+ * ENGINE_SCAN reads the age off it the same way. */
 struct tile {
     unsigned long type;
     unsigned long growth;
-    unsigned long age;
+    unsigned long born;
     int active;
     int dead;
 };
@@ -85,6 +100,34 @@ enum {
     NUM_ABILITIES
 };
 
+extern const char *ability_names[NUM_ABILITIES];
+
+/* The balance knobs of a game. Every game carries its own copy, so rule
+ * sets can be swept without rebuilding; see rules.c for the defaults and
+ * the config file format. */
+struct rules {
+    unsigned long root_active_base;
+    unsigned long flower_active_base;
+    unsigned long vine_active_base;
+    /* Plants die at this age and are cleared a turn later. */
+    unsigned long root_lifespan;
+    unsigned long flower_lifespan;
+    unsigned long vine_lifespan;
+    unsigned long repellent_lifespan;
+    /* Nectar halves every half life and turns into a root when spent. */
+    unsigned long nectar_half_life;
+    /* One in this many turns places nectar. */
+    unsigned long nectar_chance;
+    struct {
+        unsigned long initial;
+        unsigned long recurring;
+    } ability_costs[NUM_ABILITIES];
+};
+
+extern const struct rules default_rules;
+
+int set_rule(struct rules *r, const char *key, const char *value);
+int load_rules(struct rules *r, const char *path);
 
 #define STAGE_HEIGHT    20
 #define STAGE_WIDTH     80
@@ -92,10 +135,90 @@ enum {
 #define IN_STAGE(x, y)  ((x) >= 0 && (x) < STAGE_WIDTH && \
                          (y) >= 0 && (y) < STAGE_HEIGHT)
 
+/* The stage is kept in a grid with a border of STAGE_BORDER sentinel tiles
+ * all round, which nothing grows onto or walks into. Code reaching at most
+ * that far from a stage cell can index the grid without bounds checks,
+ * stepping by the linear offsets of struct offset. CELL() is the grid
+ * index of stage cell x,y and STAGE() the tile there. */
+#define STAGE_BORDER    2
+#define GRID_WIDTH      (STAGE_WIDTH + 2 * STAGE_BORDER)
+#define GRID_HEIGHT     (STAGE_HEIGHT + 2 * STAGE_BORDER)
+#define GRID_CELLS      (GRID_WIDTH * GRID_HEIGHT)
+#define CELL(x, y)      (((y) + STAGE_BORDER) * GRID_WIDTH + (x) + STAGE_BORDER)
+#define CELL_X(c)       ((c) % GRID_WIDTH - STAGE_BORDER)
+#define CELL_Y(c)       ((c) / GRID_WIDTH - STAGE_BORDER)
+#define STAGE(bb, x, y) ((bb)->grid[CELL(x, y)])
+
+struct offset {
+    int dx, dy;
+    /* dy * GRID_WIDTH + dx */
+    int d;
+};
+
+/* The 8 cells round a cell, row by row. */
+extern const struct offset ring_offsets[8];
+/* The 24 cells within two steps, row by row. */
+extern const struct offset window_offsets[24];
+/* The cells a flower grows onto and a root bursts onto, in the order the
+ * game draws and places them. */
+extern const struct offset knight_offsets[8];
+extern const struct offset burst_offsets[12];
+
+/* How simulate_bilebio() plays a turn. ENGINE_SCAN visits every cell,
+ * rolling for every idle plant and ageing every tile. ENGINE_EVENTS draws
+ * the turn a plant will activate on from the geometric distribution of
+ * those rolls when it becomes idle, works out the turn a tile next dies,
+ * vanishes or decays when it is placed, and queues both in timing wheels,
+ * so a turn only visits the cells with something due. The two play the
+ * same game in distribution, not draw for draw (see bilebio-batch -e).
+ * Games start under ENGINE_SCAN; bilebio-fork and bilebio-sweep play
+ * theirs under ENGINE_EVENTS with -E. Rollouts always scan, since the
+ * window of set_horizon() is ENGINE_SCAN's and every reseed would have to
+ * rebuild the schedule. */
+enum engine {
+    ENGINE_SCAN,
+    ENGINE_EVENTS
+};
+
+/* A rollout that looks a few turns ahead only needs the cells near the
+ * player. Plants grow at most two cells a turn (a root's burst, a flower's
+ * knight move) and the player walks one, and the borg reads plants up to
+ * three cells from the player. So with turns left, cells further than
+ * WINDOW_RADIUS(turns) from the player cannot reach anything the rollout
+ * looks at, and once out of the window they stay out. set_horizon() has
+ * ENGINE_SCAN visit only the window and leave the rest of the stage
+ * frozen. The only thing the frozen cells could still do is seed a root
+ * near the player; window_error_bound() bounds the chance of that. */
+#define WINDOW_RADIUS(turns)    (3 * (turns) + 3)
+
+#define WHEEL_SLOTS     64
+#define DUE_WORDS       ((GRID_CELLS + 31) / 32)
+
+/* Cells by the turn something happens to them: grid cell c is listed in
+ * slot when % WHEEL_SLOTS, and waits longer than the wheel stay there for
+ * the rounds in between. */
+struct wheel {
+    unsigned int when[GRID_CELLS];
+    short next[GRID_CELLS];
+    short prev[GRID_CELLS];
+    short head[WHEEL_SLOTS];
+};
+
+/* ENGINE_EVENTS' schedule: when idle plants activate, when tiles next age,
+ * and a bit per cell to visit in the coming turn. */
+struct events {
+    struct wheel activations;
+    struct wheel expiries;
+    unsigned int due[DUE_WORDS];
+};
+
 struct bilebio {
-    struct tile stage[STAGE_HEIGHT][STAGE_WIDTH];
+    struct tile grid[GRID_CELLS];
     unsigned long stage_level;
     unsigned long stage_age;
+    /* Names the layout set_stage() drew the stage from (a hash of its
+     * tiles, see layout_template()), or 0 if it is not known. */
+    unsigned long stage_template;
     unsigned long num_nectars_placed;
     int player_x, player_y;
     unsigned long player_score;
@@ -104,13 +227,50 @@ struct bilebio {
     int abilities[NUM_ABILITIES];
     unsigned long selected_ability;
     struct tile under_player;
+    unsigned long rng;
+    unsigned long activation_seed;
+    int antithetic;
+    struct rules rules;
+    /* Highest activation word that activates a plant of each type. */
+    unsigned long active_threshold[NUM_TILES];
+    /* Grid cells the turn has visited so far: tiles placed on them are
+     * first aged next turn, the others this one. place_tile() and
+     * lift_tile() convert ages to and from birth turns with it, so both
+     * engines age a placed tile on the same turn. */
+    int scanned;
+    /* Not part of the game: snapshots load as ENGINE_SCAN, with no
+     * horizon. */
+    enum engine engine;
+    /* Turns left to a rollout's horizon, or 0 for none; see
+     * WINDOW_RADIUS(). */
+    int horizon;
+    struct events events;
 };
 
-void init_bilebio(struct bilebio *bb);
+void init_bilebio(struct bilebio *bb, unsigned long seed);
+unsigned long mix32(unsigned long x);
+void bilebio_seed(struct bilebio *bb, unsigned long seed);
+void bilebio_set_antithetic(struct bilebio *bb, int antithetic);
+void set_engine(struct bilebio *bb, enum engine engine);
+void copy_bilebio(struct bilebio *dst, const struct bilebio *src);
+void copy_bilebio_scan(struct bilebio *dst, const struct bilebio *src);
+void set_horizon(struct bilebio *bb, int turns);
+double window_error_bound(const struct bilebio *bb, int turns);
+unsigned long bilebio_rand(struct bilebio *bb);
+unsigned long rand_next(unsigned long *rng, int antithetic);
+unsigned long activation_base(struct bilebio *bb);
+unsigned long activation_key(unsigned long seed, unsigned long level, unsigned long age);
+void set_activation_thresholds(struct bilebio *bb);
+void set_rules(struct bilebio *bb, const struct rules *rules);
 void set_stage(struct bilebio *bb);
+unsigned long layout_template(const struct tile (*layout)[STAGE_WIDTH]);
+void load_stage(struct bilebio *bb, const struct tile (*layout)[STAGE_WIDTH]);
+void set_stage_pack(const struct tile (*pack)[STAGE_HEIGHT][STAGE_WIDTH], unsigned long n);
 enum status update_bilebio(struct bilebio *bb);
 void age_tile(struct bilebio *bb, struct tile *t);
+unsigned long tile_age(const struct bilebio *bb, const struct tile *t);
 int is_obstructed(struct bilebio *bb, int x, int y);
+int cell_obstructed(const struct bilebio *bb, int c);
 int move_player(struct bilebio *bb, int x, int y);
 int use_ability(struct bilebio *bb, int dx, int dy);
 int try_to_place(struct bilebio *bb, int deadly, int *tries, int x, int y, struct tile t);
@@ -118,5 +278,6 @@ int try_to_place(struct bilebio *bb, int deadly, int *tries, int x, int y, struc
 void set_status(int row, chtype color, const char *fmt, ...);
 
 enum status simulate_bilebio(struct bilebio *bb, int move);
+enum status step_bilebio(struct bilebio *bb, int dx, int dy);
 
 #endif
@@ -1,11 +1,7 @@
-#include "borg.h"
-
-static struct bilebio * world = 0;
+#include <stdint.h>
 
-FILE *borg_log = 0;
-int borg_move_sober( struct bilebio * );
-
-#define MAX_ONE_IN 100
+#include "borg.h"
+#include "snapshot.h"
 
 #define FILTER( filter_things, filter_no_things, filter_exp ) { \
     for(int filter_i=0;filter_i<filter_no_things;) { \
@@ -27,20 +23,17 @@ int borg_move_sober( struct bilebio * );
     } \
 }
 
-double logp_one_in[MAX_ONE_IN];
-double logp_complement_of_one_in[MAX_ONE_IN];
+int borg_move_primitive( struct borg *, struct bilebio * );
 
-int borg_move_primitive( struct bilebio *);
-
-double desirability_map[STAGE_HEIGHT][STAGE_WIDTH];
+const int move_keys[9] = { 'y', 'k', 'u', 'h', '.', 'l', 'b', 'j', 'n' };
 
 #define JOIN_XY( x, y ) (((y)<<16) | (x))
 #define GET_X( xy ) ((xy) & 0xffff)
 #define GET_Y( xy ) ( ((xy) & 0xffff0000) >> 16 )
 
-void calculate_distances_to( struct bilebio * ctx, int x, int y, int map[STAGE_HEIGHT][STAGE_WIDTH]) {
-    static int q[STAGE_WIDTH*STAGE_HEIGHT];
-    int qs = 0;
+void calculate_distances_to( struct bilebio * ctx, int x, int y, int map[STAGE_HEIGHT][STAGE_WIDTH],
+                             int q[STAGE_WIDTH * STAGE_HEIGHT] ) {
+    int qh = 0, qs = 0;
 
     for(int i=0;i<STAGE_WIDTH;i++) for(int j=0;j<STAGE_HEIGHT;j++) {
         map[j][i] = -1;
@@ -49,17 +42,19 @@ void calculate_distances_to( struct bilebio * ctx, int x, int y, int map[STAGE_H
     map[y][x] = 0;
 
     q[qs++] = JOIN_XY( x, y );
+    PERF_COUNT( PERF_BFS_RUNS );
 
-    while( qs > 0 ) {
-        x = GET_X( q[0] );
-        y = GET_Y( q[0] );
-        memmove( &q[0], &q[1], (qs-1) * sizeof q[0] );
-        qs--;
+    // Every cell is enqueued at most once (unit costs), so a plain array
+    // with a head index is enough; the caller owns it.
+    while( qh < qs ) {
+        x = GET_X( q[qh] );
+        y = GET_Y( q[qh] );
+        qh++;
 
         for(int i=-1;i<=1;i++) for(int j=-1;j<=1;j++) if( i || j ) {
             int nx = x + i, ny = y + j;
-            if( nx < 0 || ny < 0 || nx >= STAGE_WIDTH || ny >= STAGE_HEIGHT ) continue;
-            int type = ctx->stage[ny][nx].type;
+            // The border is none of these, so nx,ny is on the stage below.
+            int type = STAGE( ctx, nx, ny ).type;
             if (type != TILE_FLOOR &&
                 type != TILE_REPELLENT &&
                 type != TILE_EXIT &&
@@ -75,143 +70,714 @@ void calculate_distances_to( struct bilebio * ctx, int x, int y, int map[STAGE_H
             }
         }
     }
+    PERF_ADD( PERF_BFS_CELLS, qs );
 }
 
-void add_desirability_from( struct bilebio * ctx, int x, int y, double base ) {
-    int d[STAGE_HEIGHT][STAGE_WIDTH];
-    calculate_distances_to( ctx, x, y, d );
+static double hit_chance( const struct bilebio * ctx, const struct tile * t, int dx, int dy );
 
-    for(int nx=0;nx<STAGE_WIDTH;nx++) for(int ny=0;ny<STAGE_HEIGHT;ny++) {
-        if( d[ny][nx] < 0 ) continue;
-        double v = base / (double)(1 + d[ny][nx]);
-        if( v > desirability_map[ny][nx] ) {
-            desirability_map[ny][nx] = v;
+// Cost of stepping onto each cell of the box x0..x1, y0..y1 (0:
+// impassable); see BORG_PATH_COSTS.
+static void calculate_step_costs( struct borg * b, struct bilebio * ctx, int x0, int y0, int x1, int y1 ) {
+    for(int y=y0;y<=y1;y++) for(int x=x0;x<=x1;x++) {
+        b->survival[y][x] = 1;
+    }
+    // Plants are few: spread each one's threat over the cells it reaches.
+    for(int y=y0-2;y<=y1+2;y++) for(int x=x0-2;x<=x1+2;x++) {
+        if( !BORG_PATH_COSTS || !IN_STAGE( x, y ) ) continue;
+        const struct tile * t = &STAGE( ctx, x, y );
+        if( !TILE_IS_PLANT( *t ) ) continue;
+        for(int dy=-2;dy<=2;dy++) for(int dx=-2;dx<=2;dx++) {
+            const int tx = x + dx, ty = y + dy;
+            if( (dx || dy) && tx >= x0 && tx <= x1 && ty >= y0 && ty <= y1 ) {
+                b->survival[ty][tx] *= 1 - hit_chance( ctx, t, -dx, -dy );
+            }
         }
     }
-}
 
-void calculate_desirability( struct bilebio * ctx ) {
-    for(int x=0;x<STAGE_WIDTH;x++) for(int y=0;y<STAGE_HEIGHT;y++) {
-        desirability_map[y][x] = 0;
-    }
-    for(int x=0;x<STAGE_WIDTH;x++) for(int y=0;y<STAGE_HEIGHT;y++) {
-        switch( ctx->stage[y][x].type ) {
+    for(int y=y0;y<=y1;y++) for(int x=x0;x<=x1;x++) {
+        int cost = PATH_STEP;
+        switch( STAGE( ctx, x, y ).type ) {
             case TILE_EXIT:
-                add_desirability_from( ctx, x, y, 100.0 );
+                b->step_cost[y][x] = PATH_STEP;
+                continue;
+            case TILE_VINE:
+            case TILE_FLOWER:
+                if( BORG_PATH_COSTS ) cost *= 2;
                 break;
+            case TILE_FLOOR:
+            case TILE_REPELLENT:
+            case TILE_NECTAR:
+            case TILE_PLAYER:
+                break;
+            default:
+                b->step_cost[y][x] = 0;
+                continue;
+        }
+        cost += (int)(PATH_DANGER * (1 - b->survival[y][x]) + 0.5);
+        b->step_cost[y][x] = cost < PATH_BUCKETS ? cost : PATH_BUCKETS - 1;
+    }
+}
+
+#define PLAN_CELLS (STAGE_WIDTH * STAGE_HEIGHT)
+// A seed of settle(): cell x,y starts at cost.
+#define SEED( cost, x, y ) ((cost) * PLAN_CELLS + (y) * STAGE_WIDTH + (x))
+
+static int compare_ints( const void * pa, const void * pb ) {
+    const int a = *(const int *) pa, b = *(const int *) pb;
+    return (a > b) - (a < b);
+}
+
+// Cheapest cost from every cell of the box x0..x1, y0..y1 to a seed, in
+// b->distance (-1: none), by Dial's algorithm: bucket i % PATH_BUCKETS
+// holds the cells queued at cost i, and no step spans the whole ring.
+// Cells are queued again when their cost drops, and stale entries are
+// skipped when their bucket comes up. Seeds join when the sweep reaches
+// their cost. With by_region, paths stay within one region.
+static void settle( struct borg * b, int no_seeds, int x0, int y0, int x1, int y1, int by_region ) {
+    int queued = 0, pending = 0, next_seed = 0;
+
+    for(int i=0;i<PATH_BUCKETS;i++) b->bucket[i] = -1;
+    for(int y=y0;y<=y1;y++) for(int x=x0;x<=x1;x++) b->distance[y][x] = -1;
+    qsort( b->seeds, no_seeds, sizeof b->seeds[0], compare_ints );
+    PERF_COUNT( PERF_BFS_RUNS );
+
+    for(int cost=0;pending || next_seed<no_seeds;cost++) {
+        if( !pending ) cost = b->seeds[next_seed] / PLAN_CELLS;
+        for(;next_seed<no_seeds && b->seeds[next_seed] / PLAN_CELLS == cost;next_seed++) {
+            const int x = b->seeds[next_seed] % STAGE_WIDTH, y = b->seeds[next_seed] % PLAN_CELLS / STAGE_WIDTH;
+            if( b->distance[y][x] >= 0 && b->distance[y][x] <= cost ) continue;
+            b->distance[y][x] = cost;
+            b->queued_cell[queued] = JOIN_XY( x, y );
+            b->queued_next[queued] = b->bucket[cost % PATH_BUCKETS];
+            b->bucket[cost % PATH_BUCKETS] = queued++;
+            pending++;
+        }
+        int e = b->bucket[cost % PATH_BUCKETS];
+        b->bucket[cost % PATH_BUCKETS] = -1;
+        for(;e>=0;e=b->queued_next[e]) {
+            const int x = GET_X( b->queued_cell[e] ), y = GET_Y( b->queued_cell[e] );
+            pending--;
+            if( b->distance[y][x] != cost ) continue;
+            // Reaching x,y from a neighbour costs the step onto x,y.
+            const int d = cost + b->step_cost[y][x];
+            for(int j=-1;j<=1;j++) for(int i=-1;i<=1;i++) if( i || j ) {
+                const int nx = x + i, ny = y + j;
+                if( nx < x0 || nx > x1 || ny < y0 || ny > y1 || !b->step_cost[ny][nx] ) continue;
+                if( by_region && b->region[ny][nx] != b->region[y][x] ) continue;
+                if( b->distance[ny][nx] >= 0 && b->distance[ny][nx] <= d ) continue;
+                b->distance[ny][nx] = d;
+                b->queued_cell[queued] = JOIN_XY( nx, ny );
+                b->queued_next[queued] = b->bucket[d % PATH_BUCKETS];
+                b->bucket[d % PATH_BUCKETS] = queued++;
+                pending++;
+            }
+        }
+    }
+    PERF_ADD( PERF_BFS_CELLS, queued );
+}
+
+static int seed_exits( struct borg * b, struct bilebio * ctx, int x0, int y0, int x1, int y1 ) {
+    int no_seeds = 0;
+    for(int y=y0;y<=y1;y++) for(int x=x0;x<=x1;x++) {
+        if( STAGE( ctx, x, y ).type == TILE_EXIT ) b->seeds[no_seeds++] = SEED( 0, x, y );
+    }
+    return no_seeds;
+}
+
+// The flat field: every cell settled with its step cost.
+static void calculate_costs_to_exit( struct borg * b, struct bilebio * ctx ) {
+    calculate_step_costs( b, ctx, 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1 );
+    settle( b, seed_exits( b, ctx, 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1 ), 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1, 0 );
+}
+
+// The walls and exits the coarse plan was made for, hashed.
+static unsigned long plan_key( const struct bilebio * ctx ) {
+    unsigned long h = 0;
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) {
+        const unsigned long type = STAGE( ctx, x, y ).type;
+        if( type == TILE_WALL || type == TILE_EXIT ) h = mix32( h ^ (type << 16 | (unsigned long)(y * STAGE_WIDTH + x)) );
+    }
+    return h ? h : 1;
+}
+
+// Cuts each block into regions, flooding the open cells of the block.
+static void find_regions( struct borg * b ) {
+    int no_regions = 0;
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) b->region[y][x] = NO_REGION;
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) {
+        if( !b->step_cost[y][x] || b->region[y][x] != NO_REGION ) continue;
+        const int bx = x - x % REGION_W, by = y - y % REGION_H;
+        int qh = 0, qs = 0;
+        b->region[y][x] = no_regions;
+        b->queue[qs++] = JOIN_XY( x, y );
+        while( qh < qs ) {
+            const int cx = GET_X( b->queue[qh] ), cy = GET_Y( b->queue[qh] );
+            qh++;
+            for(int j=-1;j<=1;j++) for(int i=-1;i<=1;i++) {
+                const int nx = cx + i, ny = cy + j;
+                if( nx < bx || nx >= bx + REGION_W || ny < by || ny >= by + REGION_H || !IN_STAGE( nx, ny ) ) continue;
+                if( !b->step_cost[ny][nx] || b->region[ny][nx] != NO_REGION ) continue;
+                b->region[ny][nx] = no_regions;
+                b->queue[qs++] = JOIN_XY( nx, ny );
+            }
+        }
+        no_regions++;
+    }
+}
+
+// The first open cell across the border from a, straight over if it can
+// be, else diagonally.
+static int cell_across( struct borg * b, int ax, int ay, int across_x, int across_y, int along_x, int along_y, int * px, int * py ) {
+    static const int order[3] = { 0, -1, 1 };
+    for(int k=0;k<3;k++) {
+        const int x = ax + across_x + order[k] * along_x, y = ay + across_y + order[k] * along_y;
+        if( IN_STAGE( x, y ) && b->step_cost[y][x] ) {
+            *px = x;
+            *py = y;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Adds an entrance for every run of up to ENTRANCE_RUN cells along a
+// border, starting at x,y, that crosses it between the same two regions:
+// a portal in the middle of the run, paired with each open cell across.
+static void find_entrances( struct borg * b, int x, int y, int along_x, int along_y, int across_x, int across_y, int len ) {
+    int start = -1, ra = 0, rb = 0;
+    for(int i=0;i<=len;i++) {
+        const int ax = x + i * along_x, ay = y + i * along_y;
+        int bx, by;
+        const int crosses = i < len && b->step_cost[ay][ax] &&
+                            cell_across( b, ax, ay, across_x, across_y, along_x, along_y, &bx, &by );
+        if( start >= 0 && (!crosses || i - start >= ENTRANCE_RUN || b->region[ay][ax] != ra || b->region[by][bx] != rb) ) {
+            const int mid = (start + i - 1) / 2;
+            const int mx = x + mid * along_x, my = y + mid * along_y;
+            for(int k=-1;k<=1;k++) {
+                const int px = mx + across_x + k * along_x, py = my + across_y + k * along_y;
+                if( !IN_STAGE( px, py ) || !b->step_cost[py][px] ) continue;
+                struct portal * p = &b->portals[b->no_portals];
+                p[0].x = mx;
+                p[0].y = my;
+                p[1].x = px;
+                p[1].y = py;
+                p[0].partner = b->no_portals + 1;
+                p[1].partner = b->no_portals;
+                b->no_portals += 2;
+            }
+            start = -1;
+        }
+        if( crosses && start < 0 ) {
+            start = i;
+            ra = b->region[ay][ax];
+            rb = b->region[by][bx];
+        }
+    }
+}
+
+// The coarse plan: regions and portals from the walls, the cost from each
+// portal to an exit by Dijkstra's algorithm over the portals, and from
+// those the coarse cost of every cell. Steps all cost PATH_STEP here.
+static void make_plan( struct borg * b, struct bilebio * ctx ) {
+    PERF_COUNT( PERF_PLANS );
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) {
+        b->step_cost[y][x] = STAGE( ctx, x, y ).type == TILE_WALL ? 0 : PATH_STEP;
+    }
+    find_regions( b );
+    b->no_portals = 0;
+    for(int x=REGION_W;x<STAGE_WIDTH;x+=REGION_W) find_entrances( b, x - 1, 0, 0, 1, 1, 0, STAGE_HEIGHT );
+    for(int y=REGION_H;y<STAGE_HEIGHT;y+=REGION_H) find_entrances( b, 0, y - 1, 1, 0, 0, 1, STAGE_WIDTH );
+
+    // Portals start at their cost to an exit of their own region.
+    settle( b, seed_exits( b, ctx, 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1 ), 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1, 1 );
+    for(int i=0;i<b->no_portals;i++) {
+        b->portals[i].cost = b->distance[b->portals[i].y][b->portals[i].x];
+        b->portal_done[i] = 0;
+    }
+    for(;;) {
+        int n = -1;
+        for(int i=0;i<b->no_portals;i++) {
+            const int c = b->portals[i].cost;
+            if( !b->portal_done[i] && c >= 0 && (n < 0 || c < b->portals[n].cost) ) n = i;
+        }
+        if( n < 0 ) break;
+        b->portal_done[n] = 1;
+        const struct portal p = b->portals[n];
+        struct portal * q = &b->portals[p.partner];
+        if( q->cost < 0 || q->cost > p.cost + PATH_STEP ) q->cost = p.cost + PATH_STEP;
+        // The other portals of the region, through the region.
+        const int bx = p.x - p.x % REGION_W, by = p.y - p.y % REGION_H;
+        const int bx1 = bx + REGION_W - 1 < STAGE_WIDTH ? bx + REGION_W - 1 : STAGE_WIDTH - 1;
+        const int by1 = by + REGION_H - 1 < STAGE_HEIGHT ? by + REGION_H - 1 : STAGE_HEIGHT - 1;
+        b->seeds[0] = SEED( 0, p.x, p.y );
+        settle( b, 1, bx, by, bx1, by1, 1 );
+        for(int i=0;i<b->no_portals;i++) {
+            struct portal * r = &b->portals[i];
+            if( b->portal_done[i] || r->x < bx || r->x > bx1 || r->y < by || r->y > by1 ) continue;
+            const int d = b->distance[r->y][r->x];
+            if( d >= 0 && (r->cost < 0 || r->cost > p.cost + d) ) r->cost = p.cost + d;
         }
     }
 
+    int no_seeds = seed_exits( b, ctx, 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1 );
+    for(int i=0;i<b->no_portals;i++) {
+        if( b->portals[i].cost >= 0 ) b->seeds[no_seeds++] = SEED( b->portals[i].cost, b->portals[i].x, b->portals[i].y );
+    }
+    settle( b, no_seeds, 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1, 1 );
+    memcpy( b->coarse_distance, b->distance, sizeof b->coarse_distance );
+}
+
+// The hierarchical field: settled cell by cell within PLAN_RADIUS of the
+// player, from the exits there and from the coarse costs just outside.
+static void calculate_costs_near( struct borg * b, struct bilebio * ctx, int * x0, int * y0, int * x1, int * y1 ) {
+    *x0 = ctx->player_x - PLAN_RADIUS > 0 ? ctx->player_x - PLAN_RADIUS : 0;
+    *y0 = ctx->player_y - PLAN_RADIUS > 0 ? ctx->player_y - PLAN_RADIUS : 0;
+    *x1 = ctx->player_x + PLAN_RADIUS < STAGE_WIDTH - 1 ? ctx->player_x + PLAN_RADIUS : STAGE_WIDTH - 1;
+    *y1 = ctx->player_y + PLAN_RADIUS < STAGE_HEIGHT - 1 ? ctx->player_y + PLAN_RADIUS : STAGE_HEIGHT - 1;
+    calculate_step_costs( b, ctx, *x0, *y0, *x1, *y1 );
+
+    int no_seeds = seed_exits( b, ctx, *x0, *y0, *x1, *y1 );
+    for(int y=*y0;y<=*y1;y++) for(int x=*x0;x<=*x1;x++) {
+        if( (x > *x0 && x < *x1 && y > *y0 && y < *y1) || !b->step_cost[y][x] ) continue;
+        int best = -1;
+        for(int j=-1;j<=1;j++) for(int i=-1;i<=1;i++) {
+            const int nx = x + i, ny = y + j;
+            if( !IN_STAGE( nx, ny ) || (nx >= *x0 && nx <= *x1 && ny >= *y0 && ny <= *y1) ) continue;
+            const int c = b->coarse_distance[ny][nx];
+            if( c >= 0 && (best < 0 || c + PATH_STEP < best) ) best = c + PATH_STEP;
+        }
+        if( best >= 0 ) b->seeds[no_seeds++] = SEED( best, x, y );
+    }
+    settle( b, no_seeds, *x0, *y0, *x1, *y1, 0 );
+}
+
+// Desirability over the box x0..x1, y0..y1 (clipped to the stage) from
+// the fine field if near, else the coarse one: 100 at an exit, falling off
+// as 1 / (1 + steps), as ever.
+static void fill_desirability( struct borg * b, int x0, int y0, int x1, int y1, int near ) {
+    for(int y=y0<0?0:y0;y<=y1 && y<STAGE_HEIGHT;y++) for(int x=x0<0?0:x0;x<=x1 && x<STAGE_WIDTH;x++) {
+        const int d = near ? b->distance[y][x] : b->coarse_distance[y][x];
+        b->desirability_map[y][x] = d < 0 ? 0 : 100.0 / (1 + (double)d / PATH_STEP);
+    }
+}
+
+static void fill_exit_dir( struct borg * b, int x0, int y0, int x1, int y1 ) {
+    for(int y=y0<0?0:y0;y<=y1 && y<STAGE_HEIGHT;y++) for(int x=x0<0?0:x0;x<=x1 && x<STAGE_WIDTH;x++) {
+        int best = 4;
+        for(int m=0;m<9;m++) {
+            const int nx = x + m % 3 - 1, ny = y + m / 3 - 1;
+            if( !IN_STAGE( nx, ny ) ) continue;
+            if( b->desirability_map[ny][nx] > b->desirability_map[y + best / 3 - 1][x + best % 3 - 1] ) best = m;
+        }
+        b->exit_dir[y][x] = best;
+    }
+}
+
+void calculate_desirability( struct borg * b, struct bilebio * ctx ) {
+    int x0 = 0, y0 = 0, x1 = STAGE_WIDTH - 1, y1 = STAGE_HEIGHT - 1;
+    TRACE_BEGIN( "calculate_desirability" );
+    if( BORG_HIERARCHICAL ) {
+        const unsigned long key = plan_key( ctx );
+        if( key != b->plan_key ) {
+            make_plan( b, ctx );
+            b->plan_key = key;
+            fill_desirability( b, 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1, 0 );
+            fill_exit_dir( b, 0, 0, STAGE_WIDTH - 1, STAGE_HEIGHT - 1 );
+        } else {
+            // Only the last window strays from the coarse plan.
+            const int * w = b->plan_window;
+            fill_desirability( b, w[0], w[1], w[2], w[3], 0 );
+            fill_exit_dir( b, w[0] - 1, w[1] - 1, w[2] + 1, w[3] + 1 );
+        }
+        calculate_costs_near( b, ctx, &x0, &y0, &x1, &y1 );
+        b->plan_window[0] = x0;
+        b->plan_window[1] = y0;
+        b->plan_window[2] = x1;
+        b->plan_window[3] = y1;
+    } else {
+        calculate_costs_to_exit( b, ctx );
+    }
+    fill_desirability( b, x0, y0, x1, y1, 1 );
+    fill_exit_dir( b, x0 - 1, y0 - 1, x1 + 1, y1 + 1 );
+
     for(int y=0;y<STAGE_HEIGHT;y++) {
+        char row[STAGE_WIDTH + 2];
         for(int x=0;x<STAGE_WIDTH;x++) {
-            int ch = ( ((int)tile_display( ctx->stage[y][x] )) & A_CHARTEXT);
+            int ch = ( ((int)tile_display( STAGE( ctx, x, y ) )) & A_CHARTEXT);
             if( ch == '.' ) {
                 double thr = 60.0;
                 int cch = '9';
                 while( cch != '0' ) {
-                    if( desirability_map[y][x] >= thr ) break;
+                    if( b->desirability_map[y][x] >= thr ) break;
                     thr *= 0.6;
                     cch--;
                 }
                 ch = cch;
             }
-            fprintf( borg_log, "%c",  ch );
+            row[x] = ch;
         }
-        fprintf( borg_log, "\n" );
+        row[STAGE_WIDTH] = '\n';
+        row[STAGE_WIDTH + 1] = 0;
+        fputs( row, b->log );
     }
+    TRACE_END( "calculate_desirability" );
 }
 
-void initialize_borg( struct bilebio * real_world ) {
-    world = real_world;
+// Sets b up to play real_world, logging to the end of log_path, or
+// nowhere if it is NULL. Returns 0, leaving b->log NULL, if the log cannot
+// be opened.
+int initialize_borg( struct borg * b, struct bilebio * real_world, const char * log_path ) {
+    memset( b, 0, sizeof *b );
+    b->world = real_world;
+    b->crisis_file = BORG_CRISIS_FILE;
+    b->rollout_move = borg_move_sober;
+    borg_seed( b, 0 );
 
-    logp_one_in[0] = 0; // N/A
+    b->logp_one_in[0] = 0; // N/A
     for(int i=1;i<MAX_ONE_IN;i++) {
-        logp_one_in[i] = log( 1.0 / ((double)i) );
-        logp_complement_of_one_in[i] = log( ((double)(i-1)) / ((double)i) );
+        b->logp_one_in[i] = log( 1.0 / ((double)i) );
+        b->logp_complement_of_one_in[i] = log( ((double)(i-1)) / ((double)i) );
     }
 
-    borg_log = fopen( "bbborg.log", "a" );
+    b->log = log_path ? fopen( log_path, "a" ) : fopen( "/dev/null", "w" );
+    if( !b->log ) return 0;
+
+    if( load_rollout_policy( b, ROLLOUT_POLICY_FILE ) ) {
+        fprintf( b->log, "[borg] rollouts use the pattern policy from %s\n", ROLLOUT_POLICY_FILE );
+    }
+    return 1;
+}
+
+// The borg's own random stream, so that borgs do not share rand()'s.
+void borg_seed( struct borg * b, unsigned long seed ) {
+    b->rng = mix32( seed ^ 0x2545f491UL );
+}
+
+static unsigned long borg_rand( struct borg * b ) {
+    return rand_next( &b->rng, 0 );
+}
+
+void borg_print( struct borg * b, const char * s ) {
+    fprintf( b->log, "[borg_print] %s\n", s );
 }
 
-void borg_print(const char*s) {
-    fprintf( borg_log, "[borg_print] %s\n", s );
+// Writes the crisis position kept by borg_move(), if any.
+static void save_crisis( struct borg * b ) {
+    if( b->crisis_pending && b->crisis_file ) save_bilebio( &b->crisis, b->crisis_file );
+    b->crisis_pending = 0;
 }
 
-void quit_borg() {
-    fclose( borg_log );
+void quit_borg( struct borg * b ) {
+    save_crisis( b );
+    if( b->log ) fclose( b->log );
+    b->log = 0;
+    free( b->rollout_policy );
+    b->rollout_policy = 0;
 }
 
-void print_cell( struct tile *t ) {
-    fprintf( borg_log, "%c", (int) ( ((int)tile_display( *t )) & A_CHARTEXT) );
+void print_cell( struct borg * b, struct tile *t ) {
+    fprintf( b->log, "%c", (int) ( ((int)tile_display( *t )) & A_CHARTEXT) );
     if( t->active ) {
-        fprintf( borg_log, "!" );
+        fprintf( b->log, "!" );
     } else {
-        fprintf( borg_log, " " );
+        fprintf( b->log, " " );
     }
 }
 
-double log_survival_from( struct tile *t, int dx, int dy) {
+double log_survival_from( struct borg * b, struct tile *t, int dx, int dy) {
     if( !t->active ) {
         return 0;
     }
     switch( t->type ) {
         case TILE_VINE:
             if( dx*dx <= 1 && dy*dy <= 1 ) {
-                return logp_complement_of_one_in[9];
+                return b->logp_complement_of_one_in[9];
             }
             return 0;
         case TILE_FLOWER:
             if( (dx*dx == 4 && dy*dy == 1) || (dx*dx == 1 && dy*dy == 4) ) {
-                return logp_complement_of_one_in[8];
+                return b->logp_complement_of_one_in[8];
             }
             return 0;
         case TILE_ROOT:
             if( (dx*dx+dy*dy) <= 2 && (dx || dy) ) {
-                return logp_one_in[5];
+                return b->logp_one_in[5];
             }
             return 0;
     }
     return 0;
 }
 
-double log_survival_at( struct tile (*map)[STAGE_WIDTH], int x, int y ) {
+// Off the stage is border, which threatens nothing.
+double log_survival_at( struct borg * b, struct bilebio * ctx, int x, int y ) {
     double log_survival = 0;
     for(int i=-2;i<=2;i++) for(int j=-2;j<=2;j++) if( i || j ) {
-        if( (x+i) < 0 || (x+i) >= STAGE_WIDTH ) continue;
-        if( (y+j) < 0 || (y+j) >= STAGE_HEIGHT ) continue;
-        log_survival += log_survival_from( &map[y+j][x+i], i, j );
+        log_survival += log_survival_from( b, &STAGE( ctx, x+i, y+j ), i, j );
     }
     return log_survival;
 }
 
-int mc_survival_game( struct bilebio * holodeck, int (*f)(struct bilebio *) ) {
-    for(int i=0;i<10;i++) {
-        if( simulate_bilebio( holodeck, f(holodeck) ) == STATUS_DEAD ) return 0;
+// Chance that a plant dx,dy away from the player grows onto it next turn.
+static double hit_chance( const struct bilebio * ctx, const struct tile * t, int dx, int dy ) {
+    double p_hit;
+    switch( t->type ) {
+        case TILE_VINE:
+            // One of the 3x3 cells around the vine.
+            if( dx*dx > 1 || dy*dy > 1 || t->growth == 0 ) return 0;
+            p_hit = 1.0 / 9;
+            break;
+        case TILE_FLOWER:
+            // One of the 8 knight moves.
+            if( !((dx*dx == 4 && dy*dy == 1) || (dx*dx == 1 && dy*dy == 4)) || t->growth == 0 ) return 0;
+            p_hit = 1.0 / 8;
+            break;
+        case TILE_ROOT:
+            // Bursts four times in five.
+            if( !((dx == 0 && dy*dy <= 4) || (dy == 0 && dx*dx <= 4) || (dx*dx == 1 && dy*dy == 1)) ) return 0;
+            p_hit = 4.0 / 5;
+            break;
+        default:
+            return 0;
     }
-    return 1;
+    if( t->active ) return p_hit;
+    // Idle plants have to activate first (see ACTIVE()).
+    return p_hit * ((double)ctx->active_threshold[t->type] + 1) / 4294967296.0;
+}
+
+// Steps from x,y to the exit, read off the desirability field.
+static double exit_distance( struct borg * b, int x, int y ) {
+    const double des = b->desirability_map[y][x];
+    return des > 0 ? 100.0 / des - 1 : STAGE_WIDTH * STAGE_HEIGHT;
+}
+
+// The chance that no plant within two steps grows onto cell p next turn.
+static double static_survival( const struct bilebio * ctx, int p ) {
+    double survival = 1;
+    for(int i=0;i<24;i++) {
+        const struct offset o = window_offsets[i];
+        survival *= 1 - hit_chance( ctx, &ctx->grid[p + o.d], -o.dx, -o.dy );
+    }
+    return survival;
+}
+
+// A leaf that made steps towards the exit over the MC_DEPTH+1 turns of a
+// rollout: progress counts 0 for as many steps back, 1 for as many
+// forward.
+static double leaf_value( double survival, double steps, double gained ) {
+    double progress = 0.5 + 0.5 * steps / (MC_DEPTH + 1);
+    if( progress < 0 ) progress = 0;
+    if( progress > 1 ) progress = 1;
+    return survival * (1 - MC_LEAF_PROGRESS - MC_LEAF_ENERGY + MC_LEAF_PROGRESS * progress + MC_LEAF_ENERGY * gained);
 }
 
-int mc_survival_or_energy_loss_game( struct bilebio * holodeck, int (*f)(struct bilebio*) ) {
-    unsigned int energy = holodeck->player_energy;
-    for(int i=0;i<10;i++) {
-        if( simulate_bilebio( holodeck, f(holodeck) ) == STATUS_DEAD ) return 0;
+// Static value of the position ctx reached from root, in [0, 1]: the
+// chance of living through the next turn, most of the weight, plus a
+// little for steps made towards the exit and for energy gained. Clearing
+// the stage is worth 1.
+double borg_evaluate( struct borg * b, struct bilebio * ctx, const struct bilebio * root ) {
+    if( ctx->player_dead ) return 0;
+    if( ctx->stage_level > root->stage_level ) return 1;
+
+    const double survival = static_survival( ctx, CELL( ctx->player_x, ctx->player_y ) );
+    const double steps = exit_distance( b, root->player_x, root->player_y ) - exit_distance( b, ctx->player_x, ctx->player_y );
+    double gained = 0;
+    if( ctx->player_energy > root->player_energy ) {
+        gained = (ctx->player_energy - root->player_energy) / MC_LEAF_ENERGY_SCALE;
+        if( gained > 1 ) gained = 1;
+    }
+    return leaf_value( survival, steps, gained );
+}
+
+// One plus the move_keys index of each plain move key.
+static const unsigned char key_move[128] = {
+    ['y'] = 1, ['k'] = 2, ['u'] = 3, ['h'] = 4, ['.'] = 5, ['l'] = 6, ['b'] = 7, ['j'] = 8, ['n'] = 9,
+};
+
+// simulate_bilebio() for rollouts: plain moves take step_bilebio().
+static enum status rollout_step( struct bilebio * holodeck, int key ) {
+    const int m = key >= 0 && key < 128 ? key_move[key] - 1 : -1;
+    if( m < 0 ) return simulate_bilebio( holodeck, key );
+    return step_bilebio( holodeck, m % 3 - 1, m / 3 - 1 );
+}
+
+// Energy an action spends; ability actions are only put up when they take
+// effect.
+static unsigned long action_cost( const struct bilebio * ctx, int action ) {
+    return ACTION_ABILITY( action ) ? ctx->rules.ability_costs[ACTION_ABILITY( action )].recurring : 0;
+}
+
+// Plays an action on a holodeck; rollouts go on with plain moves.
+static enum status play_action( struct bilebio * holodeck, int action ) {
+    if( !ACTION_ABILITY( action ) ) return rollout_step( holodeck, action );
+    holodeck->selected_ability = ACTION_ABILITY( action );
+    const enum status st = rollout_step( holodeck, ACTION_KEY( action ) );
+    holodeck->selected_ability = ABILITY_MOVE;
+    return st;
+}
+
+// Plays up to MC_DEPTH turns of the rollout policy on a holodeck of root,
+// through rollout_step(). A death, or ending below energy (a Life save),
+// scores 0; otherwise the leaf scores 1, or its borg_evaluate() value with
+// MC_LEAF_EVAL.
+double mc_survival_or_energy_loss_game( struct borg * b, struct bilebio * holodeck, const struct bilebio * root,
+                                        unsigned long energy ) {
+    if( holodeck->player_dead ) return 0;
+    for(int i=0;i<MC_DEPTH && holodeck->stage_level == root->stage_level;i++) {
+        PERF_COUNT( PERF_ROLLOUT_TURNS );
+        if( rollout_step( holodeck, b->rollout_move( b, holodeck ) ) == STATUS_DEAD ) return 0;
     }
     if( holodeck->player_energy < energy ) return 0;
-    return 1;
+    return MC_LEAF_EVAL ? borg_evaluate( b, holodeck, root ) : 1;
+}
+
+// Rollout i of every candidate replays the same random streams (common
+// random numbers), so differences between candidates come from the moves
+// rather than from the dice. With MC_ANTITHETIC, rollouts 2k and 2k+1
+// share a seed and draw complementary numbers.
+void seed_holodeck( struct bilebio * holodeck, unsigned long seed, int i ) {
+    if( MC_ANTITHETIC ) {
+        bilebio_seed( holodeck, seed + 0x9e3779b9UL * (unsigned long)(i / 2) );
+        bilebio_set_antithetic( holodeck, i & 1 );
+    } else {
+        bilebio_seed( holodeck, seed + 0x9e3779b9UL * (unsigned long) i );
+    }
+}
+
+// Outcomes are averaged per antithetic pair before taking the variance,
+// since the two halves of a pair are deliberately not independent.
+static double mc_standard_error( const double *xs, int n ) {
+    const int k = MC_ANTITHETIC ? 2 : 1;
+    const int m = n / k;
+    if( m < 2 ) return 0;
+    double mean = 0, var = 0;
+    for(int i=0;i<m;i++) {
+        double v = 0;
+        for(int j=0;j<k;j++) v += xs[i*k+j];
+        mean += v / k;
+    }
+    mean /= m;
+    for(int i=0;i<m;i++) {
+        double v = 0;
+        for(int j=0;j<k;j++) v += xs[i*k+j];
+        var += (v / k - mean) * (v / k - mean);
+    }
+    return sqrt( var / (m - 1) / m );
+}
+
+// Plays rollouts est->n .. est->n+count-1 of initial_move and folds them
+// into est.
+void mc_extend( struct borg * b, struct bilebio * ctx, int initial_move, unsigned long seed, struct mc_estimate * est, int count ) {
+    struct bilebio * holodeck = &b->holodeck;
+    double wins = est->mean * est->n;
+    int total = est->n + count;
+    if( total > MC_MAX_ROLLOUTS ) total = MC_MAX_ROLLOUTS;
+    TRACE_BEGIN_ARG( "mc_survival_rate", "move", initial_move );
+    for(int i=est->n;i<total;i++) {
+        TRACE_BEGIN_ARG( "rollout", "index", i );
+        copy_bilebio_scan( holodeck, ctx );
+        seed_holodeck( holodeck, seed, i );
+        if( MC_WINDOW ) set_horizon( holodeck, MC_DEPTH + 1 );
+        PERF_COUNT( PERF_ROLLOUTS );
+        PERF_COUNT( PERF_ROLLOUT_TURNS );
+        play_action( holodeck, initial_move );
+        est->outcome[i] = mc_survival_or_energy_loss_game( b, holodeck, ctx,
+                                                           ctx->player_energy - action_cost( ctx, initial_move ) );
+        wins += est->outcome[i];
+        TRACE_END( "rollout" );
+    }
+    TRACE_END( "mc_survival_rate" );
+    est->n = total;
+    est->mean = total ? wins / (double) total : 0;
+    est->se = mc_standard_error( est->outcome, total );
 }
 
-double mc_survival_rate( struct bilebio * ctx, int initial_move ) {
-    struct bilebio holodeck;
-    int wins = 0, total = 10;
-    for(int i=0;i<total;i++) {
-        memcpy( &holodeck, ctx, sizeof holodeck );
-        simulate_bilebio( &holodeck, initial_move );
-        wins += mc_survival_or_energy_loss_game( &holodeck, borg_move_sober );
+double mc_survival_rate( struct borg * b, struct bilebio * ctx, int initial_move, unsigned long seed, struct mc_estimate * est ) {
+    est->n = 0;
+    est->mean = 0;
+    est->alive = 1;
+    mc_extend( b, ctx, initial_move, seed, est, MC_SAMPLES );
+    return est->mean;
+}
+
+// Standard error of the paired difference a - b over their common rollouts.
+double mc_paired_se( struct borg * b, const struct mc_estimate * x, const struct mc_estimate * y ) {
+    const int n = x->n < y->n ? x->n : y->n;
+    for(int i=0;i<n;i++) b->paired[i] = x->outcome[i] - y->outcome[i];
+    return mc_standard_error( b->paired, n );
+}
+
+static int mc_best_alive( const struct mc_estimate * est, int n ) {
+    int best = -1;
+    for(int j=0;j<n;j++) {
+        if( est[j].alive && (best < 0 || est[j].mean > est[best].mean) ) best = j;
+    }
+    return best;
+}
+
+// Successive halving over one budget per decision: MC_SAMPLES rollouts a
+// candidate, as the fixed allocation spends, but never over MC_BUDGET.
+// Every round splits its share of the remaining budget evenly over the
+// surviving candidates, who all play the same (paired) rollout indices.
+// After a round, candidates confidently worse than the best are raced out,
+// then the worse half is dropped; candidates tied with the best always
+// survive, since the final choice among those is made on desirability.
+// Stops early once the survivors can no longer be told apart, or when the
+// budget cannot give each of them another pair. A lone candidate is not
+// raced and plays MC_SAMPLES. Returns the number of rollouts played.
+int mc_race( struct borg * b, struct bilebio * ctx, const int * candidates, int n, unsigned long seed, struct mc_estimate * est ) {
+    const int budget = n * MC_SAMPLES < MC_BUDGET ? n * MC_SAMPLES : MC_BUDGET;
+    int used = 0, survivors = n, rounds = 1;
+    while( (1 << rounds) < n ) rounds++;
+
+    for(int j=0;j<n;j++) {
+        est[j].n = 0;
+        est[j].mean = est[j].se = est[j].se_vs_best = 0;
+        est[j].alive = 1;
+    }
+    if( n == 1 ) {
+        mc_extend( b, ctx, candidates[0], seed, &est[0], MC_SAMPLES );
+        return est[0].n;
+    }
+
+    for(int r=0;r<rounds && survivors > 0;r++) {
+        int per = (budget - used) / ((rounds - r) * survivors);
+        if( r == 0 && per < MC_RACE_MIN ) per = MC_RACE_MIN;
+        if( per > (budget - used) / survivors ) per = (budget - used) / survivors;
+        per -= per % 2;
+        if( per < 2 ) break;
+
+        for(int j=0;j<n;j++) if( est[j].alive ) {
+            const int before = est[j].n;
+            mc_extend( b, ctx, candidates[j], seed, &est[j], per );
+            used += est[j].n - before;
+        }
+
+        const int best = mc_best_alive( est, n );
+        int settled = 1;
+        for(int j=0;j<n;j++) if( est[j].alive ) {
+            est[j].se_vs_best = mc_paired_se( b, &est[j], &est[best] );
+            if( est[j].mean != est[best].mean || est[j].se_vs_best > 0 ) settled = 0;
+        }
+        if( survivors == 1 || settled ) break;
+
+        const int keep = (survivors + 1) / 2;
+        for(int j=0;j<n;j++) if( est[j].alive ) {
+            const double gap = est[best].mean - est[j].mean;
+            int rank = 0;
+            for(int k=0;k<n;k++) {
+                if( est[k].alive && est[k].mean > est[j].mean ) rank++;
+            }
+            if( gap > MC_RACE_Z * est[j].se_vs_best || (gap > 0 && rank >= keep) ) {
+                est[j].alive = 0;
+            }
+        }
+        survivors = 0;
+        for(int j=0;j<n;j++) survivors += est[j].alive;
     }
-    return wins / (double) total;
+    return used;
 }
 
-void borg_move_candidates( struct bilebio *ctx, int *candidates, int *no_candidates ) {
+void borg_move_candidates( struct borg * b, struct bilebio *ctx, int *candidates, int *no_candidates ) {
     int keys[3][3] = {
         { 'y', 'k', 'u' },
         { 'h', '.', 'l' },
@@ -222,14 +788,14 @@ void borg_move_candidates( struct bilebio *ctx, int *candidates, int *no_candida
     for(int i=-1;i<=1;i++) for(int j=-1;j<=1;j++) {
         const int x = ctx->player_x + i, y = ctx->player_y + j; 
         const int key = keys[j+1][i+1];
-        struct tile * t = &ctx->stage[y][x];
+        struct tile * t = &STAGE( ctx, x, y );
         if( is_obstructed( ctx, x, y ) && t->type != TILE_EXIT ) continue;
 
         // If we want to step on plants, we must accurately calculate the risk involved!
         if( t->type == TILE_VINE || t->type == TILE_FLOWER ) continue;
 
 
-        double log_survival = log_survival_at( ctx->stage, x, y );
+        double log_survival = log_survival_at( b, ctx, x, y );
         if( log_survival > best_log_survival ) {
             best_log_survival = log_survival;
             *no_candidates = 0;
@@ -240,143 +806,467 @@ void borg_move_candidates( struct bilebio *ctx, int *candidates, int *no_candida
     }
 }
 
-void borg_postmortem() {
-    fprintf( borg_log, "Died @ %d,%d with %lusc/%luen at stage %lu\n", world->player_x, world->player_y, world->player_score, world->player_energy, world->stage_level );
+// The cells along the eight rays from the player (in ring_offsets order),
+// four deep: bit 4 * r + k - 1 stands for the cell k steps along ray r.
+// Built once per decision, so each ability's legality is a mask test.
+#define RAY_BIT( r, k ) (1u << (4 * (r) + (k) - 1))
+#define RAY( r ) (0xfu << (4 * (r)))
+struct ray_masks {
+    uint32_t open, wall, plant, root, floor;
+};
+
+static const int ray_keys[8] = { 'y', 'k', 'u', 'h', 'l', 'b', 'j', 'n' };
+
+static void ray_masks( const struct bilebio * ctx, struct ray_masks * m ) {
+    memset( m, 0, sizeof *m );
+    for(int r=0;r<8;r++) for(int k=1;k<=4;k++) {
+        const int x = ctx->player_x + k * ring_offsets[r].dx, y = ctx->player_y + k * ring_offsets[r].dy;
+        if( !IN_STAGE( x, y ) ) break;
+        const int c = CELL( x, y );
+        const struct tile * t = &ctx->grid[c];
+        const uint32_t bit = RAY_BIT( r, k );
+        if( !cell_obstructed( ctx, c ) ) m->open |= bit;
+        if( t->type == TILE_WALL ) m->wall |= bit;
+        if( TILE_IS_PLANT( *t ) ) m->plant |= bit;
+        if( t->type == TILE_ROOT ) m->root |= bit;
+        if( t->type == TILE_FLOOR ) m->floor |= bit;
+    }
+}
+
+// Where an action leaves the player.
+static void action_target( const struct bilebio * ctx, int action, int * x, int * y ) {
+    int steps = 1;
+    const int m = key_move[ACTION_KEY( action )] - 1;
+    switch( ACTION_ABILITY( action ) ) {
+        case ABILITY_DASH: steps = 4; break;
+        case ABILITY_PLANT_HOP: case ABILITY_WALL_HOP: steps = 2; break;
+        case ABILITY_REPELLENT: case ABILITY_SPAWN_WALL: steps = 0; break;
+    }
+    *x = ctx->player_x + steps * (m % 3 - 1);
+    *y = ctx->player_y + steps * (m / 3 - 1);
+}
+
+static void action_name( int action, char name[3] ) {
+    int n = 0;
+    if( ACTION_ABILITY( action ) ) name[n++] = '0' + ACTION_ABILITY( action );
+    name[n++] = ACTION_KEY( action );
+    name[n] = 0;
+}
+
+// borg_move_candidates(), then the abilities the player owns and can pay
+// for: a dash, hop, wall walk or attack whose landing cell is as safe as
+// the best plain move, and while the player's cell is in danger,
+// repellent or a wall on the most threatened neighbouring floor.
+void borg_action_candidates( struct borg * b, struct bilebio * ctx, int * candidates, int * no_candidates ) {
+    struct ray_masks m;
+    double best = -1000;
+
+    borg_move_candidates( b, ctx, candidates, no_candidates );
+    for(int i=0;i<*no_candidates;i++) {
+        int x, y;
+        action_target( ctx, candidates[i], &x, &y );
+        const double s = log_survival_at( b, ctx, x, y );
+        if( s > best ) best = s;
+    }
+    int usable[NUM_ABILITIES] = { 0 };
+    int any = 0;
+    for(int a=1;a<NUM_ABILITIES;a++) {
+        usable[a] = ctx->abilities[a] && ctx->player_energy >= ctx->rules.ability_costs[a].recurring;
+        any |= usable[a];
+    }
+    if( !any ) return;
+    ray_masks( ctx, &m );
+
+#define PUT( ability, key ) do { \
+        if( *no_candidates < BORG_MAX_ACTIONS ) candidates[(*no_candidates)++] = ACTION( ability, key ); \
+    } while( 0 )
+    for(int r=0;r<8;r++) {
+        int legal[NUM_ABILITIES] = { 0 };
+        legal[ABILITY_DASH] = (m.open & RAY( r )) == RAY( r );
+        legal[ABILITY_PLANT_HOP] = (m.plant & RAY_BIT( r, 1 )) && (m.open & RAY_BIT( r, 2 ));
+        legal[ABILITY_WALL_HOP] = (m.wall & RAY_BIT( r, 1 )) && (m.open & RAY_BIT( r, 2 ));
+        legal[ABILITY_WALL_WALK] = (m.wall & RAY_BIT( r, 1 )) != 0;
+        legal[ABILITY_ATTACK] = (m.plant & ~m.root & RAY_BIT( r, 1 )) != 0;
+        for(int a=1;a<NUM_ABILITIES;a++) if( usable[a] && legal[a] ) {
+            const int action = ACTION( a, ray_keys[r] );
+            int x, y;
+            action_target( ctx, action, &x, &y );
+            if( log_survival_at( b, ctx, x, y ) >= best ) PUT( a, ray_keys[r] );
+        }
+    }
+
+    if( log_survival_at( b, ctx, ctx->player_x, ctx->player_y ) >= 0 ) return;
+    if( usable[ABILITY_REPELLENT] ) PUT( ABILITY_REPELLENT, '.' );
+    if( usable[ABILITY_SPAWN_WALL] ) {
+        int worst = -1;
+        double lowest = 0;
+        for(int r=0;r<8;r++) if( m.floor & RAY_BIT( r, 1 ) ) {
+            const double s = log_survival_at( b, ctx, ctx->player_x + ring_offsets[r].dx, ctx->player_y + ring_offsets[r].dy );
+            if( s < lowest ) {
+                lowest = s;
+                worst = r;
+            }
+        }
+        if( worst >= 0 ) PUT( ABILITY_SPAWN_WALL, ray_keys[worst] );
+    }
+#undef PUT
+}
+
+void borg_postmortem( struct borg * b ) {
+    const struct bilebio * world = b->world;
+    fprintf( b->log, "Died @ %d,%d with %lusc/%luen at stage %lu\n", world->player_x, world->player_y, world->player_score, world->player_energy, world->stage_level );
     for(int y=0;y<STAGE_HEIGHT;y++) {
         for(int x=0;x<STAGE_WIDTH;x++) {
-            int ch = ( ((int)tile_display( world->stage[y][x] )) & A_CHARTEXT);
-            fprintf( borg_log, "%c", ch );
+            int ch = ( ((int)tile_display( STAGE( world, x, y ) )) & A_CHARTEXT);
+            fprintf( b->log, "%c", ch );
         }
-        fprintf( borg_log, "\n" );
+        fprintf( b->log, "\n" );
     }
 }
 
-void build_move_map( struct bilebio *ctx, int *candidates, int no_candidates, int xs[256], int ys[256] ) {
-    for(int i=0;i<no_candidates;i++) {
-        int x = ctx->player_x, y = ctx->player_y;
-        switch( candidates[i] ) {
-            case 'y': --y; --x; break;
-            case 'k': --y; break;
-            case 'u': --y; ++x; break;
-            case 'b': ++y; --x; break;
-            case 'j': ++y; break;
-            case 'n': ++y; ++x; break;
-            case 'h': --x; break;
-            case 'l': ++x; break;
+// Fills b->danger. An active plant grows next turn and an idle one that
+// can activate the turn after; what they place cannot grow before the
+// third turn.
+void borg_danger_map( struct borg * b, const struct bilebio * ctx ) {
+    memset( b->danger, 0, sizeof b->danger );
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) {
+        const int c = CELL( x, y );
+        const struct tile * t = &ctx->grid[c];
+        if( !TILE_IS_PLANT( *t ) ) continue;
+        int turn;
+        if( t->active ) turn = 1;
+        else if( t->type == TILE_ROOT || t->growth > 0 ) turn = 2;
+        else continue;
+        const struct offset * o = burst_offsets;
+        int n = 12;
+        if( t->type == TILE_FLOWER ) {
+            o = knight_offsets;
+            n = 8;
+        } else if( t->type == TILE_VINE ) {
+            o = ring_offsets;
+            n = 8;
+        }
+        for(int i=0;i<n;i++) {
+            unsigned char * d = &b->danger[c + o[i].d];
+            if( !*d || *d > turn ) *d = turn;
         }
-        xs[ candidates[i] ] = x;
-        ys[ candidates[i] ] = y;
     }
 }
 
-int borg_move() {
-    const int sz = 16;
-    int candidates[sz];
+// Whether an action is safe for DANGER_TURNS: it clears the stage, or
+// lands where no plant can grow.
+static int action_safe( struct borg * b, const struct bilebio * ctx, int action ) {
+    int x, y;
+    action_target( ctx, action, &x, &y );
+    return STAGE( ctx, x, y ).type == TILE_EXIT || !b->danger[CELL( x, y )];
+}
+
+// What a rollout of a safe action would score, on the scale of
+// borg_evaluate(), without playing one. The player walks the rest of the
+// horizon down the exit field from where the action lands; a walk that
+// reaches the exit clears the stage. The leaf pays the static survival of
+// the cell the walk ends on, as a rollout's leaf does. Deaths in the turns
+// after DANGER_TURNS are not charged: rollouts of safe actions die there
+// well under 1% of the time, while charging each turn the static survival
+// of the walk's cell, which the rollout policy would step away from,
+// underrates them. Energy gained is not foreseen.
+static double safe_value( struct borg * b, const struct bilebio * ctx, int action ) {
+    int x, y;
+    action_target( ctx, action, &x, &y );
+    const double start = exit_distance( b, ctx->player_x, ctx->player_y );
+    for(int i=0;;i++) {
+        if( STAGE( ctx, x, y ).type == TILE_EXIT ) return 1;
+        const int m = b->exit_dir[y][x];
+        if( i == MC_DEPTH || m == 4 ) break;
+        x += m % 3 - 1;
+        y += m / 3 - 1;
+    }
+    return leaf_value( static_survival( ctx, CELL( x, y ) ), start - exit_distance( b, x, y ), 0 );
+}
+
+static double move_desirability( struct borg * b, const struct bilebio *ctx, int action ) {
+    int x, y;
+    action_target( ctx, action, &x, &y );
+    return b->desirability_map[y][x];
+}
+
+int borg_move( struct borg * b ) {
+    struct bilebio * world = b->world;
+    int candidates[BORG_MAX_CANDIDATES];
     int no_candidates;
-    borg_move_candidates( world, candidates, &no_candidates );
-    double wisdoms[sz];
+    char name[3];
+
+    // The rest of an ability action.
+    if( b->pending_key ) {
+        const int key = b->pending_key;
+        b->pending_key = 0;
+        return key;
+    }
+    if( world->selected_ability != ABILITY_MOVE ) return '0' + ABILITY_MOVE;
 
-    fprintf( borg_log, "== DECISION ==\n" );
+    TRACE_BEGIN( "borg_move" );
+    PERF_BEGIN( decision );
+    PERF_BEGIN( candidates );
+    borg_action_candidates( b, world, candidates, &no_candidates );
+    PERF_END( candidates, PERF_T_CANDIDATES );
 
-    calculate_desirability( world );
+    double wisdoms[BORG_MAX_CANDIDATES];
+    struct mc_estimate * estimates = b->estimates;
+    const unsigned long seed = borg_rand( b );
+    const unsigned long turns_before = PERF_GET( PERF_ROLLOUT_TURNS );
 
+    PERF_COUNT( PERF_DECISIONS );
+    fprintf( b->log, "== DECISION ==\n" );
+
+    PERF_BEGIN( desirability );
+    calculate_desirability( b, world );
+    PERF_END( desirability, PERF_T_DESIRABILITY );
+
+    PERF_BEGIN( monte_carlo );
     double best_chance = -1;
-    for(int j=0;j<no_candidates;j++) {
-        double wisdom = mc_survival_rate( world, candidates[j] );
+    int best = 0;
+    // Safe candidates go to the front and are rated by safe_value()
+    // without rollouts.
+    int safe = 0;
+    if( BORG_DANGER_PRUNE ) {
+        borg_danger_map( b, world );
+        for(int j=0;j<no_candidates;j++) if( action_safe( b, world, candidates[j] ) ) {
+            const int c = candidates[j];
+            memmove( &candidates[safe+1], &candidates[safe], (j - safe) * sizeof candidates[0] );
+            candidates[safe++] = c;
+        }
+        for(int j=0;j<safe;j++) {
+            estimates[j].n = 0;
+            estimates[j].mean = safe_value( b, world, candidates[j] );
+            estimates[j].se = estimates[j].se_vs_best = 0;
+            estimates[j].alive = 1;
+            wisdoms[j] = estimates[j].mean;
+            if( wisdoms[j] > best_chance ) {
+                best_chance = wisdoms[j];
+                best = j;
+            }
+        }
+        PERF_ADD( PERF_SAFE_CANDIDATES, safe );
+        PERF_ADD( PERF_UNCERTAIN_CANDIDATES, no_candidates - safe );
+    }
+#if MC_ALLOCATION == MC_ALLOC_HALVING
+    int rollouts = mc_race( b, world, candidates + safe, no_candidates - safe, seed, estimates + safe );
+    for(int j=safe;j<no_candidates;j++) {
+        wisdoms[j] = estimates[j].alive ? estimates[j].mean : -1;
+        if( wisdoms[j] > best_chance ) {
+            best_chance = wisdoms[j];
+            best = j;
+        }
+    }
+#else
+    int rollouts = 0;
+    for(int j=safe;j<no_candidates;j++) {
+        double wisdom = mc_survival_rate( b, world, candidates[j], seed, &estimates[j] );
+        rollouts += estimates[j].n;
 
         wisdoms[j] = wisdom;
         if( wisdom > best_chance ) {
             best_chance = wisdom;
+            best = j;
         }
     }
 
+    for(int j=0;j<no_candidates;j++) {
+        estimates[j].se_vs_best = mc_paired_se( b, &estimates[j], &estimates[best] );
+    }
+#endif
+    PERF_END( monte_carlo, PERF_T_MONTE_CARLO );
+    PERF_MAX( PERF_MAX_DECISION_ROLLOUTS, rollouts );
+    PERF_MAX( PERF_MAX_DECISION_TURNS, PERF_GET( PERF_ROLLOUT_TURNS ) - turns_before );
+    (void) turns_before;
+    fprintf( b->log, "%d rollouts\n", rollouts );
+
+    // Keep the latest hard position around for bilebio-fork.
+    if( b->crisis_file && best_chance < BORG_CRISIS_SURVIVAL ) {
+        copy_bilebio( &b->crisis, world );
+        b->crisis_pending = 1;
+    } else {
+        save_crisis( b );
+    }
+
+    PERF_BEGIN( select );
+
     for(int j=0;j<no_candidates;) {
-        fprintf( borg_log, "%c --> %lf: ", candidates[j], wisdoms[j] );
-        if( wisdoms[j] < best_chance ) {
-            fprintf( borg_log, "discard\n" );
+        action_name( candidates[j], name );
+        fprintf( b->log, "%s --> %lf +- %lf over %d (vs best %+lf +- %lf): ", name, estimates[j].mean, estimates[j].se,
+                 estimates[j].n, estimates[j].mean - estimates[best].mean, estimates[j].se_vs_best );
+        if( wisdoms[j] < best_chance - MC_TIE ) {
+            fprintf( b->log, "discard\n" );
             memmove( &candidates[j], &candidates[j+1], (no_candidates-(j+1)) * sizeof candidates[0] );
             memmove( &wisdoms[j], &wisdoms[j+1], (no_candidates-(j+1)) * sizeof wisdoms[0] );
+            memmove( &estimates[j], &estimates[j+1], (no_candidates-(j+1)) * sizeof estimates[0] );
             no_candidates--;
         } else {
-            fprintf( borg_log, "keep\n" );
+            fprintf( b->log, "keep\n" );
             j++;
         }
-        fflush( borg_log );
+        fflush( b->log );
     }
 
-    int xs[256], ys[256];
-
     double max_desirability = 0;
 
-    build_move_map( world, candidates, no_candidates, xs, ys );
-
     for(int i=0;i<no_candidates;i++) {
-        double des = desirability_map[ ys[ candidates[i] ] ][ xs[ candidates[ i ] ] ];
-        fprintf( borg_log, "desirability of %lf [%d,%d] (%c)\n", des, xs[candidates[i]], ys[candidates[i]], candidates[i] );
+        int x, y;
+        action_target( world, candidates[i], &x, &y );
+        action_name( candidates[i], name );
+        fprintf( b->log, "desirability of %lf [%d,%d] (%s)\n", b->desirability_map[y][x], x, y, name );
     }
 
-#define F(i) ( desirability_map[ys[i]][xs[i]] )
+#define F(i) ( move_desirability( b, world, i ) )
     MAXIMIZE( candidates, no_candidates, F, double, max_desirability );
 #undef F
-#define F(i) ( desirability_map[ys[i]][xs[i]] == max_desirability )
+#define F(i) ( move_desirability( b, world, i ) == max_desirability )
     FILTER( candidates, no_candidates, F )
 #undef F
 
-    int rv = rand() % no_candidates;
+    int rv = borg_rand( b ) % no_candidates;
     for(int i=0;i<no_candidates;i++) {
-        fprintf( borg_log, "Candidate %c\n", candidates[i] );
+        action_name( candidates[i], name );
+        fprintf( b->log, "Candidate %s\n", name );
     }
-    fprintf( borg_log, "Selected %c\n", candidates[rv] );
+    action_name( candidates[rv], name );
+    fprintf( b->log, "Selected %s\n", name );
+    PERF_END( select, PERF_T_SELECT );
 
     for(int j=-3;j<=3;j++) {
         for(int i=-3;i<=3;i++) {
             const int x = world->player_x + i, y = world->player_y + j; 
             if( x < 0 || y < 0 || x >= STAGE_WIDTH || y >= STAGE_HEIGHT ) continue;
-            print_cell( &world->stage[y][x] );
+            print_cell( b, &STAGE( world, x, y ) );
         }
-        fprintf( borg_log, "\n" );
+        fprintf( b->log, "\n" );
     }
 
-    fprintf( borg_log, "\n" );
-    fprintf( borg_log, "== MOVE: %c ==\n", candidates[rv] );
-    fflush( borg_log );
+    fprintf( b->log, "\n" );
+    fprintf( b->log, "== MOVE: %s ==\n", name );
+    fflush( b->log );
+    PERF_END( decision, PERF_T_DECISION );
+    TRACE_END( "borg_move" );
 
+    if( ACTION_ABILITY( candidates[rv] ) ) {
+        b->pending_key = ACTION_KEY( candidates[rv] );
+        return '0' + ACTION_ABILITY( candidates[rv] );
+    }
     return candidates[rv];
 }
 
-int borg_move_primitive( struct bilebio * ctx ) {
-    int candidates[16];
+int borg_move_primitive( struct borg * b, struct bilebio * ctx ) {
+    int candidates[BORG_MAX_CANDIDATES];
     int no_candidates;
-    borg_move_candidates( ctx, candidates, &no_candidates );
+    borg_move_candidates( b, ctx, candidates, &no_candidates );
 
     if( !no_candidates ) {
         return '.';
     }
-    int key = candidates[rand() % no_candidates];
+    int key = candidates[bilebio_rand( ctx ) % no_candidates];
     return key;
 }
 
-int borg_move_sober( struct bilebio * ctx ) {
-    int candidates[16];
+int borg_move_sober( struct borg * b, struct bilebio * ctx ) {
+    int candidates[BORG_MAX_CANDIDATES];
     int no_candidates;
-    borg_move_candidates( ctx, candidates, &no_candidates );
-    int xs[256], ys[256];
-
-    build_move_map( ctx, candidates, no_candidates, xs, ys );
+    borg_move_candidates( b, ctx, candidates, &no_candidates );
 
     double max_desirability = 0;
-#define F(i) ( desirability_map[ys[i]][xs[i]] )
+#define F(i) ( move_desirability( b, ctx, i ) )
     MAXIMIZE( candidates, no_candidates, F, double, max_desirability );
 #undef F
-#define F(i) ( desirability_map[ys[i]][xs[i]] == max_desirability )
+#define F(i) ( move_desirability( b, ctx, i ) == max_desirability )
     FILTER( candidates, no_candidates, F )
 #undef F
 
     if( !no_candidates ) {
-        fprintf( borg_log, "no_candidates situation, max des is %lf\n", max_desirability );
+        fprintf( b->log, "no_candidates situation, max des is %lf\n", max_desirability );
         return '.';
     }
 
-    int key = candidates[rand() % no_candidates];
+    int key = candidates[bilebio_rand( ctx ) % no_candidates];
     return key;
 }
+
+// Pattern classes for the rollout policy: 0 open, 1 blocked, 2 idle vine
+// or flower (passable half the time), 3 any active plant. The border is
+// blocked.
+static const unsigned char pattern_class[2][NUM_TILES] = {
+    { 0, 0, 1, 0, 1, 2, 2, 0, 0, 1 },
+    { 0, 0, 1, 0, 3, 3, 3, 0, 0, 1 },
+};
+
+// The eight neighbours of the player, two bits each, under the coarse
+// direction to the exit (exit_dir of the player's cell).
+int pattern_key( struct borg * b, struct bilebio * ctx ) {
+    const int p = CELL( ctx->player_x, ctx->player_y );
+    int key = b->exit_dir[ctx->player_y][ctx->player_x];
+    for(int m=0;m<8;m++) {
+        const struct tile * t = &ctx->grid[p + ring_offsets[m].d];
+        key = (key << 2) | pattern_class[t->active != 0][t->type];
+    }
+    return key;
+}
+
+// Table lookup rollout step; falls back to the sober policy for patterns
+// the table has never seen.
+int borg_move_pattern( struct borg * b, struct bilebio * ctx ) {
+    const int m = b->rollout_policy[pattern_key( b, ctx )];
+    if( m >= 9 ) return borg_move_sober( b, ctx );
+    return move_keys[m];
+}
+
+// File layout: ROLLOUT_POLICY_MAGIC, a 32-bit entry count, then one byte
+// per pattern key (a move_keys index, or ROLLOUT_POLICY_UNKNOWN).
+int load_rollout_policy( struct borg * b, const char * path ) {
+    FILE * f = fopen( path, "rb" );
+    char magic[8];
+    uint32_t entries;
+    if( !f ) return 0;
+
+    unsigned char * table = malloc( ROLLOUT_POLICY_ENTRIES );
+    if( !table ||
+        fread( magic, 1, sizeof magic, f ) != sizeof magic ||
+        memcmp( magic, ROLLOUT_POLICY_MAGIC, sizeof magic ) ||
+        fread( &entries, sizeof entries, 1, f ) != 1 ||
+        entries != ROLLOUT_POLICY_ENTRIES ||
+        fread( table, 1, ROLLOUT_POLICY_ENTRIES, f ) != ROLLOUT_POLICY_ENTRIES ) {
+        fprintf( stderr, "%s: not a rollout policy table\n", path );
+        free( table );
+        fclose( f );
+        return 0;
+    }
+    fclose( f );
+
+    free( b->rollout_policy );
+    b->rollout_policy = table;
+    b->rollout_move = borg_move_pattern;
+    return 1;
+}
+
+int save_rollout_policy( const char * path, const unsigned char * table ) {
+    FILE * f = fopen( path, "wb" );
+    const uint32_t entries = ROLLOUT_POLICY_ENTRIES;
+    if( !f ) return 0;
+    int ok = fwrite( ROLLOUT_POLICY_MAGIC, 1, 8, f ) == 8 &&
+             fwrite( &entries, sizeof entries, 1, f ) == 1 &&
+             fwrite( table, 1, ROLLOUT_POLICY_ENTRIES, f ) == ROLLOUT_POLICY_ENTRIES;
+    return fclose( f ) == 0 && ok;
+}
+
+// Plays the borg on bb without a screen until it dies, reaches stage
+// stop_level (0: no limit) or max_turns keys have been played (0: no
+// limit). b must have been set up by initialize_borg(); it plays on bb
+// from here on.
+enum status borg_play( struct borg * b, struct bilebio * bb, unsigned long stop_level, unsigned long max_turns, unsigned long * turns ) {
+    enum status st = STATUS_ALIVE;
+    unsigned long n = 0;
+    b->world = bb;
+    while( st == STATUS_ALIVE && (!max_turns || n < max_turns) && (!stop_level || bb->stage_level < stop_level) ) {
+        st = simulate_bilebio( bb, borg_move( b ) );
+        n++;
+    }
+    if( turns ) *turns = n;
+    return st;
+}
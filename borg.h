@@ -3,10 +3,228 @@
 
 #include "bilebio.h"
 
-void initialize_borg( struct bilebio * );
-void quit_borg();
-int borg_move();
-void borg_print(const char*);
-void borg_postmortem();
+/* borg_move() snapshots positions it rates below this survival chance. */
+#define BORG_CRISIS_SURVIVAL 0.5
+#define BORG_CRISIS_FILE "borg.crisis.sav"
+
+#define MC_SAMPLES 10
+#define MC_ANTITHETIC 1
+
+/* How rollouts are spread over the candidates of one decision: a fixed
+ * MC_SAMPLES each, or successive halving over a shared budget of as many,
+ * capped at MC_BUDGET. */
+#define MC_ALLOC_FIXED 0
+#define MC_ALLOC_HALVING 1
+#define MC_ALLOCATION MC_ALLOC_HALVING
+
+#define MC_BUDGET 90
+#define MC_RACE_MIN 6   /* rollouts before a candidate may be raced out */
+#define MC_RACE_Z 2.0
+
+#define MC_MAX_ROLLOUTS MC_BUDGET
+
+/* Rollouts stop after MC_DEPTH turns, or when they clear the stage. With
+ * MC_LEAF_EVAL a surviving rollout scores borg_evaluate() of its last
+ * position instead of a flat 1; progress and energy weigh in at most
+ * MC_LEAF_PROGRESS and MC_LEAF_ENERGY of that. */
+#ifndef MC_DEPTH
+#define MC_DEPTH 4
+#endif
+/* With MC_WINDOW rollouts simulate only the cells that can reach what
+ * they look at in MC_DEPTH+1 turns (see WINDOW_RADIUS()). */
+#ifndef MC_WINDOW
+#define MC_WINDOW 1
+#endif
+#ifndef MC_LEAF_EVAL
+#define MC_LEAF_EVAL 1
+#endif
+/* Graded values are never quite equal, so borg_move() leaves candidates
+ * within MC_TIE of the best to the desirability tie-break. */
+#ifndef MC_TIE
+#define MC_TIE (MC_LEAF_EVAL ? 0.02 : 0)
+#endif
+#ifndef MC_LEAF_PROGRESS
+#define MC_LEAF_PROGRESS 0.05
+#endif
+#define MC_LEAF_ENERGY 0.02
+#define MC_LEAF_ENERGY_SCALE 16.0
+
+struct mc_estimate {
+    double mean;
+    double se; /* standard error of the mean */
+    double se_vs_best; /* standard error of the paired difference to the best candidate */
+    int n;
+    int alive;
+    double outcome[MC_MAX_ROLLOUTS];
+};
+
+/* Rollout policy table: 9 exit directions times 4^8 neighbour patterns. */
+#define ROLLOUT_POLICY_FILE "bbpolicy.dat"
+#define ROLLOUT_POLICY_MAGIC "BBPOLCY1"
+#define ROLLOUT_POLICY_ENTRIES (9 << 16)
+#define ROLLOUT_POLICY_UNKNOWN 0xff
+
+#define BORG_MAX_CANDIDATES 16
+
+/* Before the Monte Carlo, borg_move() marks the cells some plant could
+ * grow onto within DANGER_TURNS turns, assuming every idle plant that can
+ * activate does so at once and ignoring what blocks growth. A candidate
+ * landing anywhere else is safe for that long and is not rolled out; it
+ * is rated on the scale of the rollouts' leaves without one (see
+ * safe_value() in borg.c). No growth in this game is certain (a root
+ * bursts four times in five, flowers and vines pick a cell at random),
+ * so no cell can be proved lethal. Past two turns a root seeded near the
+ * player could burst, and every cell would be in doubt. */
+#ifndef BORG_DANGER_PRUNE
+#define BORG_DANGER_PRUNE 1
+#endif
+#define DANGER_TURNS 2
+
+/* borg_move() weighs actions: a plain move key, or an ability and the
+ * direction key to use it with. It plays an ability action as the key
+ * selecting the ability, the direction, then '0' for plain moves again.
+ * Ability actions are only put up while there are fewer than
+ * MC_BUDGET / MC_RACE_MIN candidates, so the first round of the race
+ * stays within the budget. */
+#define ACTION( ability, key ) ((ability) << 8 | (key))
+#define ACTION_KEY( a ) ((a) & 0xff)
+#define ACTION_ABILITY( a ) ((a) >> 8)
+#define BORG_MAX_ACTIONS (MC_BUDGET / MC_RACE_MIN)
+#define MAX_ONE_IN 100
+
+/* The desirability map is a cost-to-exit field. With BORG_PATH_COSTS a
+ * step costs PATH_STEP onto open ground, twice that onto a vine or flower
+ * (the move only gets through half the time), plus PATH_DANGER times the
+ * chance that a plant grows onto the cell next turn; without, every step
+ * costs PATH_STEP. Step costs stay below PATH_BUCKETS, so a bucket queue
+ * (Dial's algorithm) settles the field in linear time. */
+#ifndef BORG_PATH_COSTS
+#define BORG_PATH_COSTS 1
+#endif
+#define PATH_STEP 4
+#define PATH_DANGER 48
+#define PATH_BUCKETS 64
+
+/* With BORG_HIERARCHICAL the field is settled cell by cell only within
+ * PLAN_RADIUS of the player, as far as the rollouts look. Further out it
+ * is read off a coarse plan made from the walls and exits alone and kept
+ * until they change. The plan cuts the stage into REGION_W by REGION_H
+ * blocks and each block into regions, the open cells connected within it.
+ * Each run of at most ENTRANCE_RUN cells along a block border that
+ * crosses between the same two regions is an entrance: a portal in its
+ * middle cell paired with each open cell across from it. The plan prices
+ * the portals by Dijkstra's algorithm over the portals, then every cell
+ * from the portals and exits of its region. The fine field starts from
+ * the coarse costs just outside the window, so plants only count near
+ * the player. */
+#ifndef BORG_HIERARCHICAL
+#define BORG_HIERARCHICAL 1
+#endif
+#ifndef PLAN_RADIUS
+#define PLAN_RADIUS WINDOW_RADIUS( MC_DEPTH + 1 )
+#endif
+#define REGION_W 8
+#define REGION_H 5
+#ifndef ENTRANCE_RUN
+#define ENTRANCE_RUN 3
+#endif
+#define NO_REGION 0xffff
+/* Every position along a block border starts at most one entrance, of at
+ * most three pairs. */
+#define MAX_PORTALS (6 * ((STAGE_WIDTH - 1) / REGION_W * STAGE_HEIGHT + (STAGE_HEIGHT - 1) / REGION_H * STAGE_WIDTH))
+#define PATH_MAX_SEEDS (STAGE_WIDTH * STAGE_HEIGHT + MAX_PORTALS)
+/* Every cell is queued at most once per neighbour, plus the seeds. */
+#define PATH_MAX_QUEUED (8 * STAGE_WIDTH * STAGE_HEIGHT + PATH_MAX_SEEDS)
+
+struct portal {
+    int x, y;
+    int partner; /* the portal across the border */
+    int cost; /* to an exit, or -1 for none */
+};
+
+/* Everything one borg thinks with. The scratch space of a decision is
+ * part of it, so borg_move() neither allocates nor puts large arrays on
+ * the stack, and any number of borgs can play side by side, one per
+ * thread or several per thread. */
+struct borg {
+    struct bilebio *world;
+    /* Appended to, or /dev/null; see initialize_borg(). */
+    FILE *log;
+    /* borg_move() snapshots positions it rates below BORG_CRISIS_SURVIVAL
+     * here; NULL turns crisis snapshots off. The latest such position is
+     * kept in crisis and written once the borg is out of danger again or
+     * quits, rather than on every hard decision. */
+    const char *crisis_file;
+    struct bilebio crisis;
+    int crisis_pending;
+    /* Seeds the rollouts and breaks ties; see borg_seed(). */
+    unsigned long rng;
+
+    double logp_one_in[MAX_ONE_IN];
+    double logp_complement_of_one_in[MAX_ONE_IN];
+
+    double desirability_map[STAGE_HEIGHT][STAGE_WIDTH];
+    /* Index (see move_keys) of the neighbour with the best desirability. */
+    unsigned char exit_dir[STAGE_HEIGHT][STAGE_WIDTH];
+
+    /* The coarse plan (see BORG_HIERARCHICAL), for the walls and exits
+     * hashed to plan_key (0: none yet). */
+    unsigned long plan_key;
+    unsigned short region[STAGE_HEIGHT][STAGE_WIDTH];
+    int coarse_distance[STAGE_HEIGHT][STAGE_WIDTH];
+    struct portal portals[MAX_PORTALS];
+    int no_portals;
+    /* x0, y0, x1, y1 of the window last settled cell by cell. */
+    int plan_window[4];
+
+    /* Rollout policy table, indexed by pattern_key(); see
+     * load_rollout_policy(). */
+    unsigned char *rollout_policy;
+    int (*rollout_move)( struct borg *, struct bilebio * );
+    /* The direction key of the ability action borg_move() is playing, or
+     * 0. */
+    int pending_key;
+
+    /* Scratch. */
+    int distance[STAGE_HEIGHT][STAGE_WIDTH];
+    int queue[STAGE_WIDTH * STAGE_HEIGHT];
+    unsigned char step_cost[STAGE_HEIGHT][STAGE_WIDTH];
+    double survival[STAGE_HEIGHT][STAGE_WIDTH];
+    int bucket[PATH_BUCKETS];
+    int queued_cell[PATH_MAX_QUEUED];
+    int queued_next[PATH_MAX_QUEUED];
+    int seeds[PATH_MAX_SEEDS];
+    unsigned char portal_done[MAX_PORTALS];
+    /* The first turn a plant could grow onto each grid cell, or 0 if
+     * none can within DANGER_TURNS. */
+    unsigned char danger[GRID_CELLS];
+    struct bilebio holodeck;
+    struct mc_estimate estimates[BORG_MAX_CANDIDATES];
+    double paired[MC_MAX_ROLLOUTS];
+};
+
+int initialize_borg( struct borg *, struct bilebio *, const char * );
+void borg_seed( struct borg *, unsigned long );
+void quit_borg( struct borg * );
+int borg_move( struct borg * );
+void borg_print( struct borg *, const char * );
+void borg_postmortem( struct borg * );
+enum status borg_play( struct borg *, struct bilebio *, unsigned long, unsigned long, unsigned long * );
+void calculate_desirability( struct borg *, struct bilebio * );
+void calculate_distances_to( struct bilebio *, int, int, int map[STAGE_HEIGHT][STAGE_WIDTH],
+                             int queue[STAGE_WIDTH * STAGE_HEIGHT] );
+
+double mc_survival_rate( struct borg *, struct bilebio *, int, unsigned long, struct mc_estimate * );
+double borg_evaluate( struct borg *, struct bilebio *, const struct bilebio * );
+
+extern const int move_keys[9];
+int pattern_key( struct borg *, struct bilebio * );
+int borg_move_sober( struct borg *, struct bilebio * );
+int borg_move_pattern( struct borg *, struct bilebio * );
+void borg_move_candidates( struct borg *, struct bilebio *, int *, int * );
+void borg_action_candidates( struct borg *, struct bilebio *, int *, int * );
+void borg_danger_map( struct borg *, const struct bilebio * );
+int load_rollout_policy( struct borg *, const char * );
+int save_rollout_policy( const char *, const unsigned char * );
 
 #endif
@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "borg.h"
+#include "results.h"
+#include "snapshot.h"
+
+// Batch driver: forks many borg games from saved positions (see
+// borg.crisis.sav or the 'S' key) to measure how survivable they are.
+// Every experiment resumes the snapshot with its own random streams.
+// The workers are forked processes, each with its own borg; each sends its
+// results back through a pipe, and with -o also appends its games to a
+// results file. -E plays the games under ENGINE_EVENTS.
+
+struct outcome {
+    unsigned long experiment;
+    unsigned long turns;
+    unsigned long stages;
+    long score;
+    int status;
+};
+
+static const char * results_path;
+static enum engine engine = ENGINE_SCAN;
+static struct borg borg;
+
+static void run_worker( const struct bilebio * start, int worker, int workers, unsigned long experiments,
+                        unsigned long seed, unsigned long max_turns, unsigned long stages, unsigned long tag,
+                        int out ) {
+    struct bilebio bb;
+    struct outcome o;
+    struct result r;
+    struct results_sink * sink = results_path ? results_open( results_path ) : NULL;
+
+    for(unsigned long i=worker;i<experiments;i+=workers) {
+        bb = *start;
+        bilebio_seed( &bb, seed + i );
+        set_engine( &bb, engine );
+        borg_seed( &borg, seed + i );
+        o.experiment = i;
+        o.status = borg_play( &borg, &bb, stages ? start->stage_level + stages : 0, max_turns, &o.turns );
+        o.stages = bb.stage_level - start->stage_level;
+        o.score = (long)bb.player_score - (long)start->player_score;
+        if( sink ) {
+            result_of( &r, &bb, seed + i, tag, o.status, o.turns, start->stage_level );
+            results_add( sink, &r );
+        }
+        if( write( out, &o, sizeof o ) != sizeof o ) break;
+    }
+    if( sink && !results_close( sink ) ) fprintf( stderr, "%s: could not write results\n", results_path );
+}
+
+static int run_snapshot( const char * path, unsigned long tag, unsigned long experiments, int workers,
+                         unsigned long seed, unsigned long max_turns, unsigned long stages ) {
+    struct bilebio start;
+    struct outcome o;
+    unsigned long died = 0, cleared = 0, timeout = 0, turns = 0, n = 0;
+    double score = 0;
+    int fds[2];
+
+    if( !load_bilebio( &start, path ) ) {
+        fprintf( stderr, "%s: not a BileBio snapshot\n", path );
+        return 0;
+    }
+    if( pipe( fds ) ) {
+        perror( "pipe" );
+        return 0;
+    }
+
+    fflush( stdout );
+    for(int w=0;w<workers;w++) {
+        if( fork() == 0 ) {
+            close( fds[0] );
+            run_worker( &start, w, workers, experiments, seed, max_turns, stages, tag, fds[1] );
+            // exit(), not _exit(), so a -fprofile-generate build writes the
+            // worker's profile; stdout was flushed before the fork.
+            exit( 0 );
+        }
+    }
+    close( fds[1] );
+
+    while( read( fds[0], &o, sizeof o ) == sizeof o ) {
+        if( o.status == STATUS_DEAD ) died++;
+        else if( o.stages >= stages ) cleared++;
+        else timeout++;
+        turns += o.turns;
+        score += o.score;
+        n++;
+    }
+    close( fds[0] );
+    while( wait( NULL ) > 0 );
+
+    printf( "%s: stage %lu, %lu experiments: %.3f cleared %lu stage(s), %.3f died, %.3f timed out; %.1f turns, %+.1f score\n",
+            path, start.stage_level, n, n ? (double)cleared / n : 0.0, stages, n ? (double)died / n : 0.0,
+            n ? (double)timeout / n : 0.0, n ? (double)turns / n : 0.0, n ? score / n : 0.0 );
+    return n == experiments;
+}
+
+int main( int argc, char **argv ) {
+    unsigned long experiments = 1000, seed = time( 0 ), max_turns = 2000, stages = 1;
+    int workers = sysconf( _SC_NPROCESSORS_ONLN ), opt, ok = 1;
+    struct bilebio bb;
+
+    while( (opt = getopt( argc, argv, "n:j:t:l:s:o:E" )) != -1 ) {
+        switch( opt ) {
+            case 'n': experiments = strtoul( optarg, 0, 0 ); break;
+            case 'j': workers = atoi( optarg ); break;
+            case 't': max_turns = strtoul( optarg, 0, 0 ); break;
+            case 'l': stages = strtoul( optarg, 0, 0 ); break;
+            case 's': seed = strtoul( optarg, 0, 0 ); break;
+            case 'o': results_path = optarg; break;
+            case 'E': engine = ENGINE_EVENTS; break;
+            default:
+                break;
+        }
+    }
+    if( optind >= argc || workers < 1 ) {
+        fprintf( stderr, "usage: %s [-n experiments] [-j workers] [-t max turns] [-l stages] [-s seed] [-o results] [-E] snapshot...\n", argv[0] );
+        fprintf( stderr, "  an experiment succeeds once the borg clears -l more stages (0: survive -t turns)\n" );
+        fprintf( stderr, "  -o appends every game to a results file, tagged with its snapshot's position\n" );
+        fprintf( stderr, "  -E plays the games under the event-driven engine (ENGINE_EVENTS)\n" );
+        return 1;
+    }
+
+    init_bilebio( &bb, seed );
+    if( !initialize_borg( &borg, &bb, NULL ) ) {
+        perror( "/dev/null" );
+        return 1;
+    }
+    borg.crisis_file = NULL;
+
+    for(int i=optind;i<argc;i++)
+        ok &= run_snapshot( argv[i], i - optind, experiments, workers, seed, max_turns, stages );
+    return !ok;
+}
@@ -0,0 +1,148 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "perf.h"
+
+#ifdef BILEBIO_PERF
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+__thread struct perf_block *perf_tls = NULL;
+
+static struct perf_block *perf_blocks = NULL;
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *counter_names[NUM_PERF_COUNTERS] = {
+    "turns",
+    "tiles_scanned",
+    "place_planted",
+    "place_occupied",
+    "place_off_stage",
+    "place_killed",
+    "place_life_saved",
+    "activate_root",
+    "activate_flower",
+    "activate_vine",
+    "stage_resets",
+    "bfs_runs",
+    "bfs_cells",
+    "plans",
+    "decisions",
+    "rollouts",
+    "rollout_turns",
+    "safe_candidates",
+    "uncertain_candidates",
+    "max_decision_rollouts",
+    "max_decision_turns",
+};
+
+static const char *timer_names[NUM_PERF_TIMERS] = {
+    "decision",
+    "candidates",
+    "desirability",
+    "monte_carlo",
+    "select",
+};
+
+/* Blocks are never freed, so counts from threads that already exited are
+ * still there when the report merges them. */
+struct perf_block *perf_register(void)
+{
+    struct perf_block *b = calloc(1, sizeof(*b));
+
+    pthread_mutex_lock(&perf_lock);
+    b->next = perf_blocks;
+    perf_blocks = b;
+    pthread_mutex_unlock(&perf_lock);
+
+    perf_tls = b;
+    return b;
+}
+
+unsigned long perf_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (unsigned long)__builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+#endif
+}
+
+static int merge(struct perf_block *total)
+{
+    struct perf_block *b;
+    int i, threads = 0;
+
+    memset(total, 0, sizeof(*total));
+    pthread_mutex_lock(&perf_lock);
+    for (b = perf_blocks; b; b = b->next, ++threads) {
+        for (i = 0; i < NUM_PERF_COUNTERS; ++i) {
+            if (i == PERF_MAX_DECISION_ROLLOUTS || i == PERF_MAX_DECISION_TURNS) {
+                if (b->count[i] > total->count[i])
+                    total->count[i] = b->count[i];
+            }
+            else
+                total->count[i] += b->count[i];
+        }
+        for (i = 0; i < NUM_PERF_TIMERS; ++i) {
+            total->cycles[i] += b->cycles[i];
+            total->calls[i] += b->calls[i];
+        }
+    }
+    pthread_mutex_unlock(&perf_lock);
+    return threads;
+}
+
+static double ratio(unsigned long a, unsigned long b)
+{
+    return b ? (double)a / (double)b : 0.0;
+}
+
+/* Appends a text report and one JSON object per line. */
+void perf_report(const char *text_path, const char *json_path)
+{
+    struct perf_block t;
+    FILE *f;
+    int i, threads;
+    unsigned long places;
+
+    threads = merge(&t);
+    places = t.count[PERF_PLACE_PLANTED] + t.count[PERF_PLACE_OCCUPIED] +
+             t.count[PERF_PLACE_OFF_STAGE] + t.count[PERF_PLACE_KILLED] +
+             t.count[PERF_PLACE_LIFE_SAVED];
+
+    if (text_path && (f = fopen(text_path, "a"))) {
+        fprintf(f, "== perf (%d threads) ==\n", threads);
+        for (i = 0; i < NUM_PERF_COUNTERS; ++i)
+            fprintf(f, "%-24s %14lu\n", counter_names[i], t.count[i]);
+        fprintf(f, "%-24s %14.1f\n", "tiles_per_turn", ratio(t.count[PERF_TILES_SCANNED], t.count[PERF_TURNS]));
+        fprintf(f, "%-24s %14.3f\n", "place_planted_share", ratio(t.count[PERF_PLACE_PLANTED], places));
+        fprintf(f, "%-24s %14.1f\n", "bfs_cells_per_run", ratio(t.count[PERF_BFS_CELLS], t.count[PERF_BFS_RUNS]));
+        fprintf(f, "%-24s %14.1f\n", "rollouts_per_decision", ratio(t.count[PERF_ROLLOUTS], t.count[PERF_DECISIONS]));
+        fprintf(f, "%-24s %14.1f\n", "turns_per_decision", ratio(t.count[PERF_ROLLOUT_TURNS], t.count[PERF_DECISIONS]));
+        fprintf(f, "%-24s %14s %10s %12s %7s\n", "timer", "cycles", "calls", "cycles/call", "share");
+        for (i = 0; i < NUM_PERF_TIMERS; ++i)
+            fprintf(f, "%-24s %14lu %10lu %12.0f %6.1f%%\n", timer_names[i],
+                    t.cycles[i], t.calls[i], ratio(t.cycles[i], t.calls[i]),
+                    100.0 * ratio(t.cycles[i], t.cycles[PERF_T_DECISION]));
+        fclose(f);
+    }
+
+    if (json_path && (f = fopen(json_path, "a"))) {
+        fprintf(f, "{\"threads\": %d, \"counters\": {", threads);
+        for (i = 0; i < NUM_PERF_COUNTERS; ++i)
+            fprintf(f, "%s\"%s\": %lu", i ? ", " : "", counter_names[i], t.count[i]);
+        fprintf(f, "}, \"timers\": {");
+        for (i = 0; i < NUM_PERF_TIMERS; ++i)
+            fprintf(f, "%s\"%s\": {\"cycles\": %lu, \"calls\": %lu}", i ? ", " : "",
+                    timer_names[i], t.cycles[i], t.calls[i]);
+        fprintf(f, "}}\n");
+        fclose(f);
+    }
+}
+
+#endif
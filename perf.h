@@ -0,0 +1,83 @@
+#ifndef H_PERF
+#define H_PERF
+
+#include <stdio.h>
+
+/* Engine and borg performance counters. Everything here compiles away
+ * unless the tree is built with -DBILEBIO_PERF (make DEFS=-DBILEBIO_PERF).
+ * Each thread counts into its own block; perf_report() merges them. */
+
+enum perf_counter {
+    PERF_TURNS,
+    PERF_TILES_SCANNED,
+    PERF_PLACE_PLANTED,
+    PERF_PLACE_OCCUPIED,
+    PERF_PLACE_OFF_STAGE,
+    PERF_PLACE_KILLED,
+    PERF_PLACE_LIFE_SAVED,
+    PERF_ACTIVATE_ROOT,
+    PERF_ACTIVATE_FLOWER,
+    PERF_ACTIVATE_VINE,
+    PERF_STAGE_RESETS,
+    PERF_BFS_RUNS,
+    PERF_BFS_CELLS,
+    PERF_PLANS,
+    PERF_DECISIONS,
+    PERF_ROLLOUTS,
+    PERF_ROLLOUT_TURNS,
+    PERF_SAFE_CANDIDATES,
+    PERF_UNCERTAIN_CANDIDATES,
+    PERF_MAX_DECISION_ROLLOUTS,
+    PERF_MAX_DECISION_TURNS,
+    NUM_PERF_COUNTERS
+};
+
+enum perf_timer {
+    PERF_T_DECISION,
+    PERF_T_CANDIDATES,
+    PERF_T_DESIRABILITY,
+    PERF_T_MONTE_CARLO,
+    PERF_T_SELECT,
+    NUM_PERF_TIMERS
+};
+
+struct perf_block {
+    unsigned long count[NUM_PERF_COUNTERS];
+    unsigned long cycles[NUM_PERF_TIMERS];
+    unsigned long calls[NUM_PERF_TIMERS];
+    struct perf_block *next;
+};
+
+#ifdef BILEBIO_PERF
+
+extern __thread struct perf_block *perf_tls;
+struct perf_block *perf_register(void);
+unsigned long perf_cycles(void);
+
+#define PERF_LOCAL()        (perf_tls ? perf_tls : perf_register())
+#define PERF_COUNT(c)       (PERF_LOCAL()->count[(c)]++)
+#define PERF_ADD(c, n)      (PERF_LOCAL()->count[(c)] += (n))
+#define PERF_MAX(c, n)      do { if ((unsigned long)(n) > PERF_LOCAL()->count[(c)]) \
+                                     PERF_LOCAL()->count[(c)] = (n); } while (0)
+#define PERF_GET(c)         (PERF_LOCAL()->count[(c)])
+/* Spans nest within one function: PERF_BEGIN(x); ... PERF_END(x, PERF_T_...); */
+#define PERF_BEGIN(span)    unsigned long perf_span_##span = perf_cycles()
+#define PERF_END(span, t)   do { PERF_LOCAL()->cycles[(t)] += perf_cycles() - perf_span_##span; \
+                                 PERF_LOCAL()->calls[(t)]++; } while (0)
+#define PERF_REPORT(text, json) perf_report(text, json)
+
+void perf_report(const char *text_path, const char *json_path);
+
+#else
+
+#define PERF_COUNT(c)       ((void)0)
+#define PERF_ADD(c, n)      ((void)0)
+#define PERF_MAX(c, n)      ((void)0)
+#define PERF_GET(c)         0UL
+#define PERF_BEGIN(span)    ((void)0)
+#define PERF_END(span, t)   ((void)0)
+#define PERF_REPORT(text, json) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "borg.h"
+
+// Offline builder for the rollout policy table (see borg_move_pattern()).
+// Plays games with the sober policy and, at every position visited, scores
+// each plain move with Monte Carlo rollouts. Survival is tallied per
+// (pattern_key, move); the table keeps the best move of every pattern that
+// was seen often enough.
+
+#define MIN_TRIALS 10
+
+struct tally {
+    float wins[9];
+    float trials[9];
+};
+
+static struct borg borg;
+
+static void sample_position( struct bilebio * bb, struct tally * stats, unsigned long seed ) {
+    struct tally * t = &stats[pattern_key( &borg, bb )];
+    struct mc_estimate est;
+
+    for(int m=0;m<9;m++) {
+        const int x = bb->player_x + m % 3 - 1, y = bb->player_y + m / 3 - 1;
+        if( m != 4 ) {
+            // Same moves borg_move_candidates() would consider.
+            if( is_obstructed( bb, x, y ) && STAGE( bb, x, y ).type != TILE_EXIT ) continue;
+            if( STAGE( bb, x, y ).type == TILE_VINE || STAGE( bb, x, y ).type == TILE_FLOWER ) continue;
+        }
+        mc_survival_rate( &borg, bb, move_keys[m], seed, &est );
+        t->wins[m] += est.mean * est.n;
+        t->trials[m] += est.n;
+    }
+}
+
+int main( int argc, char **argv ) {
+    unsigned long games = 20, seed = time( 0 ), max_turns = 3000;
+    const char * path = ROLLOUT_POLICY_FILE;
+    int bootstrap = 0, opt;
+
+    while( (opt = getopt( argc, argv, "g:s:t:o:b" )) != -1 ) {
+        switch( opt ) {
+            case 'g': games = strtoul( optarg, 0, 0 ); break;
+            case 's': seed = strtoul( optarg, 0, 0 ); break;
+            case 't': max_turns = strtoul( optarg, 0, 0 ); break;
+            case 'o': path = optarg; break;
+            case 'b': bootstrap = 1; break;
+            default:
+                fprintf( stderr, "usage: %s [-g games] [-s seed] [-t max turns] [-o table] [-b]\n", argv[0] );
+                fprintf( stderr, "  -b  roll out with the existing table instead of the sober policy\n" );
+                return 1;
+        }
+    }
+
+    struct tally * stats = calloc( ROLLOUT_POLICY_ENTRIES, sizeof *stats );
+    unsigned char * table = malloc( ROLLOUT_POLICY_ENTRIES );
+    struct bilebio bb;
+    unsigned long positions = 0;
+
+    init_bilebio( &bb, seed );
+    if( !initialize_borg( &borg, &bb, NULL ) ) {
+        perror( "/dev/null" );
+        return 1;
+    }
+    if( !bootstrap ) borg.rollout_move = borg_move_sober;
+
+    for(unsigned long g=0;g<games;g++) {
+        init_bilebio( &bb, seed + g );
+        for(unsigned long turn=0;turn<max_turns;turn++) {
+            calculate_desirability( &borg, &bb );
+            sample_position( &bb, stats, seed ^ (g << 20) ^ turn );
+            positions++;
+            if( simulate_bilebio( &bb, borg_move_sober( &borg, &bb ) ) != STATUS_ALIVE ) break;
+        }
+        fprintf( stderr, "game %lu: stage %lu, %lu positions\n", g, bb.stage_level, positions );
+    }
+
+    unsigned long known = 0;
+    for(int key=0;key<ROLLOUT_POLICY_ENTRIES;key++) {
+        const struct tally * t = &stats[key];
+        const int preferred = key >> 16;
+        int best = ROLLOUT_POLICY_UNKNOWN;
+        double best_rate = -1;
+        for(int m=0;m<9;m++) {
+            if( t->trials[m] < MIN_TRIALS ) continue;
+            const double rate = t->wins[m] / t->trials[m];
+            if( rate > best_rate || (rate == best_rate && m == preferred) ) {
+                best_rate = rate;
+                best = m;
+            }
+        }
+        table[key] = best;
+        known += best != ROLLOUT_POLICY_UNKNOWN;
+    }
+
+    if( !save_rollout_policy( path, table ) ) {
+        perror( path );
+        return 1;
+    }
+    fprintf( stderr, "%lu positions, %lu patterns known; wrote %s\n", positions, known, path );
+    return 0;
+}
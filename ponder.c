@@ -0,0 +1,106 @@
+#include <pthread.h>
+
+#include "ponder.h"
+
+enum ponder_state {
+    PONDER_IDLE,
+    PONDER_THINKING,
+    PONDER_DONE,
+};
+
+struct ponder {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct borg *borg;
+    struct bilebio *position;
+    int flags;
+    enum ponder_state state;
+    int move;
+    int quit;
+};
+
+static void *ponder_thread( void *arg ) {
+    struct ponder *p = arg;
+
+    pthread_mutex_lock( &p->lock );
+    for(;;) {
+        while( !p->quit && p->state != PONDER_THINKING ) {
+            pthread_cond_wait( &p->changed, &p->lock );
+        }
+        if( p->quit ) break;
+        pthread_mutex_unlock( &p->lock );
+
+        TRACE_BEGIN( "ponder" );
+        p->borg->world = p->position;
+        const int move = borg_move( p->borg );
+        if( p->flags & PONDER_DANGER ) borg_danger_map( p->borg, p->position );
+        TRACE_END( "ponder" );
+
+        pthread_mutex_lock( &p->lock );
+        p->move = move;
+        p->state = PONDER_DONE;
+        pthread_cond_broadcast( &p->changed );
+    }
+    pthread_mutex_unlock( &p->lock );
+    return 0;
+}
+
+// Returns NULL if the thread cannot be started.
+struct ponder *ponder_new( struct borg *b ) {
+    struct ponder *p = calloc( 1, sizeof *p );
+    if( !p ) return 0;
+    p->borg = b;
+    pthread_mutex_init( &p->lock, 0 );
+    pthread_cond_init( &p->changed, 0 );
+    if( pthread_create( &p->thread, 0, ponder_thread, p ) ) {
+        pthread_cond_destroy( &p->changed );
+        pthread_mutex_destroy( &p->lock );
+        free( p );
+        return 0;
+    }
+    return p;
+}
+
+// One decision at a time: waits out the one under way, if any.
+void ponder_start( struct ponder *p, struct bilebio *bb, int flags ) {
+    ponder_wait( p );
+    pthread_mutex_lock( &p->lock );
+    p->position = bb;
+    p->flags = flags;
+    p->state = PONDER_THINKING;
+    pthread_cond_broadcast( &p->changed );
+    pthread_mutex_unlock( &p->lock );
+}
+
+// Whether ponder_wait() would return at once.
+int ponder_ready( struct ponder *p ) {
+    pthread_mutex_lock( &p->lock );
+    const int ready = p->state != PONDER_THINKING;
+    pthread_mutex_unlock( &p->lock );
+    return ready;
+}
+
+// The move of the last decision started, or 0 if none was.
+int ponder_wait( struct ponder *p ) {
+    pthread_mutex_lock( &p->lock );
+    while( p->state == PONDER_THINKING ) {
+        pthread_cond_wait( &p->changed, &p->lock );
+    }
+    const int move = p->state == PONDER_DONE ? p->move : 0;
+    pthread_mutex_unlock( &p->lock );
+    return move;
+}
+
+void ponder_free( struct ponder *p ) {
+    if( !p ) return;
+    ponder_wait( p );
+    pthread_mutex_lock( &p->lock );
+    p->quit = 1;
+    pthread_cond_broadcast( &p->changed );
+    pthread_mutex_unlock( &p->lock );
+    pthread_join( p->thread, 0 );
+    pthread_cond_destroy( &p->changed );
+    pthread_mutex_destroy( &p->lock );
+    free( p );
+}
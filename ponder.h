@@ -0,0 +1,24 @@
+#ifndef H_PONDER
+#define H_PONDER
+
+#include "borg.h"
+
+/* A thread that thinks while the game is waiting on the screen or on the
+ * player. ponder_start() hands it a decision, borg_move() for b on bb, and
+ * returns at once; ponder_wait() blocks until the move is known and
+ * returns it. It is the decision the caller would have made itself, so
+ * games play out the same with or without pondering. Until the move is
+ * known the caller must not touch b or change bb. */
+
+/* Also fill b->danger for bb (see borg_danger_map()). */
+#define PONDER_DANGER   1
+
+struct ponder;
+
+struct ponder *ponder_new(struct borg *b);
+void ponder_start(struct ponder *p, struct bilebio *bb, int flags);
+int ponder_ready(struct ponder *p);
+int ponder_wait(struct ponder *p);
+void ponder_free(struct ponder *p);
+
+#endif
@@ -0,0 +1,394 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "results.h"
+
+const char *result_column_names[NUM_RESULT_COLUMNS] = {
+    "seed", "tag", "status", "turns", "stage", "stages",
+    "score", "energy", "cause", "x", "y", "abilities",
+};
+
+/* Magic, version, record count, column count. */
+#define BLOCK_HEADER    (5 + 1 + 4 + 1)
+/* Column id and byte length. */
+#define COLUMN_HEADER   (1 + 4)
+/* Blocks claiming more records than this are taken as damage. */
+#define MAX_BLOCK       (1UL << 20)
+/* A varint of an unsigned long. */
+#define MAX_VARINT      ((sizeof(unsigned long) * CHAR_BIT + 6) / 7)
+
+struct results_sink {
+    int fd;
+    unsigned long n;
+    struct result records[RESULTS_BLOCK];
+    unsigned char buf[BLOCK_HEADER + NUM_RESULT_COLUMNS * (COLUMN_HEADER + RESULTS_BLOCK * MAX_VARINT)];
+};
+
+void result_of(struct result *r, const struct bilebio *bb, unsigned long seed, unsigned long tag,
+               enum status st, unsigned long turns, unsigned long start_level)
+{
+    int i;
+
+    r->v[RESULT_SEED] = seed;
+    r->v[RESULT_TAG] = tag;
+    r->v[RESULT_STATUS] = st;
+    r->v[RESULT_TURNS] = turns;
+    r->v[RESULT_STAGE] = bb->stage_level;
+    r->v[RESULT_STAGES] = bb->stage_level - start_level;
+    r->v[RESULT_SCORE] = bb->player_score;
+    r->v[RESULT_ENERGY] = bb->player_energy;
+    /* The plant that killed the player took its place on the stage. */
+    r->v[RESULT_CAUSE] = bb->player_dead ? STAGE(bb, bb->player_x, bb->player_y).type : TILE_FLOOR;
+    r->v[RESULT_X] = bb->player_x;
+    r->v[RESULT_Y] = bb->player_y;
+    r->v[RESULT_ABILITIES] = 0;
+    for (i = 1; i < NUM_ABILITIES; ++i)
+        if (bb->abilities[i])
+            r->v[RESULT_ABILITIES] |= 1UL << i;
+}
+
+struct results_sink *results_open(const char *path)
+{
+    struct results_sink *s = malloc(sizeof(*s));
+
+    if (!s)
+        return NULL;
+    s->n = 0;
+    if ((s->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int results_add(struct results_sink *s, const struct result *r)
+{
+    s->records[s->n++] = *r;
+    return s->n < RESULTS_BLOCK || results_flush(s);
+}
+
+static unsigned char *put_u32(unsigned char *p, unsigned long v)
+{
+    p[0] = (unsigned char)(v & 0xff);
+    p[1] = (unsigned char)((v >> 8) & 0xff);
+    p[2] = (unsigned char)((v >> 16) & 0xff);
+    p[3] = (unsigned char)((v >> 24) & 0xff);
+    return p + 4;
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return p[0] | (unsigned long)p[1] << 8 | (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+/* Differences from the previous record, zigzagged so small steps either
+ * way stay small, in 7-bit groups. */
+static unsigned char *put_delta(unsigned char *p, unsigned long v, unsigned long prev)
+{
+    unsigned long d = v - prev;
+    unsigned long z = (d << 1) ^ (0UL - (d >> (sizeof(d) * CHAR_BIT - 1)));
+
+    while (z >= 0x80) {
+        *p++ = (unsigned char)(z | 0x80);
+        z >>= 7;
+    }
+    *p++ = (unsigned char)z;
+    return p;
+}
+
+/* Returns the number of bytes read, or 0 if the varint overruns end. */
+static size_t get_delta(const unsigned char *p, const unsigned char *end, unsigned long prev,
+                        unsigned long *v)
+{
+    unsigned long z = 0;
+    size_t i;
+
+    for (i = 0; p + i < end && i < MAX_VARINT; ++i) {
+        z |= (unsigned long)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *v = prev + ((z >> 1) ^ (0UL - (z & 1)));
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static int lock(int fd, short type)
+{
+    struct flock l;
+
+    memset(&l, 0, sizeof(l));
+    l.l_type = type;
+    l.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &l) < 0)
+        if (errno != EINTR)
+            return 0;
+    return 1;
+}
+
+int results_flush(struct results_sink *s)
+{
+    unsigned char *p = s->buf, *len, *start;
+    unsigned long i, prev;
+    size_t size, done;
+    ssize_t w;
+    int c;
+
+    if (!s->n)
+        return 1;
+
+    memcpy(p, RESULTS_MAGIC, 5);
+    p += 5;
+    *p++ = RESULTS_VERSION;
+    p = put_u32(p, s->n);
+    *p++ = NUM_RESULT_COLUMNS;
+    for (c = 0; c < NUM_RESULT_COLUMNS; ++c) {
+        *p++ = (unsigned char)c;
+        len = p;
+        p += 4;
+        start = p;
+        for (i = 0, prev = 0; i < s->n; ++i) {
+            p = put_delta(p, s->records[i].v[c], prev);
+            prev = s->records[i].v[c];
+        }
+        put_u32(len, p - start);
+    }
+    size = p - s->buf;
+    s->n = 0;
+
+    /* O_APPEND puts every write at the end; the lock keeps a block's
+     * writes together and readers off half-written blocks. */
+    if (!lock(s->fd, F_WRLCK))
+        return 0;
+    for (done = 0; done < size; done += w) {
+        if ((w = write(s->fd, s->buf + done, size - done)) < 0 && errno == EINTR)
+            w = 0;
+        else if (w <= 0)
+            break;
+    }
+    lock(s->fd, F_UNLCK);
+    return done == size;
+}
+
+int results_close(struct results_sink *s)
+{
+    int ok;
+
+    if (!s)
+        return 0;
+    ok = results_flush(s);
+    ok &= close(s->fd) == 0;
+    free(s);
+    return ok;
+}
+
+int results_scan(const char *path, unsigned long mask,
+                 int (*each)(unsigned long *columns[NUM_RESULT_COLUMNS], unsigned long n, void *arg),
+                 void *arg)
+{
+    unsigned char header[BLOCK_HEADER], *data = NULL;
+    unsigned long *columns[NUM_RESULT_COLUMNS];
+    unsigned long n, cap = 0, size, data_cap = 0, i, prev;
+    size_t got, pos;
+    int c, k, id, ncols, ok = 1;
+    FILE *f;
+
+    if (!(f = fopen(path, "rb")))
+        return 0;
+    memset(columns, 0, sizeof(columns));
+    lock(fileno(f), F_RDLCK);
+
+    while (ok && (got = fread(header, 1, BLOCK_HEADER, f)) > 0) {
+        n = get_u32(header + 6);
+        ncols = header[10];
+        if (got != BLOCK_HEADER || memcmp(header, RESULTS_MAGIC, 5) ||
+            header[5] != RESULTS_VERSION || n > MAX_BLOCK) {
+            ok = 0;
+            break;
+        }
+        if (n > cap) {
+            for (c = 0; c < NUM_RESULT_COLUMNS; ++c) {
+                free(columns[c]);
+                columns[c] = NULL;
+            }
+            for (c = 0; c < NUM_RESULT_COLUMNS; ++c)
+                if ((mask >> c & 1) && !(columns[c] = malloc(n * sizeof(**columns))))
+                    ok = 0;
+            cap = n;
+        }
+        for (c = 0; c < NUM_RESULT_COLUMNS; ++c)
+            if (columns[c])
+                memset(columns[c], 0, n * sizeof(**columns));
+
+        for (k = 0; ok && k < ncols; ++k) {
+            if (fread(header, 1, COLUMN_HEADER, f) != COLUMN_HEADER) {
+                ok = 0;
+                break;
+            }
+            id = header[0];
+            size = get_u32(header + 1);
+            /* Columns this reader does not know or was not asked for. */
+            if (id >= NUM_RESULT_COLUMNS || !(mask >> id & 1)) {
+                ok = fseek(f, (long)size, SEEK_CUR) == 0;
+                continue;
+            }
+            if (size > data_cap) {
+                free(data);
+                ok = (data = malloc(size)) != NULL;
+                data_cap = ok ? size : 0;
+            }
+            if (!ok || fread(data, 1, size, f) != size) {
+                ok = 0;
+                break;
+            }
+            for (i = 0, pos = 0, prev = 0; ok && i < n; ++i) {
+                got = get_delta(data + pos, data + size, prev, &columns[id][i]);
+                prev = columns[id][i];
+                pos += got;
+                ok = got != 0;
+            }
+        }
+        ok = ok && each(columns, n, arg);
+    }
+
+    ok = ok && !ferror(f);
+    lock(fileno(f), F_UNLCK);
+    fclose(f);
+    for (c = 0; c < NUM_RESULT_COLUMNS; ++c)
+        free(columns[c]);
+    free(data);
+    return ok;
+}
+
+#ifdef RESULTS_MAIN
+
+/* bilebio-results: summarises results files, or with -d dumps them as
+ * tab-separated text. -t restricts either to the records with that tag. */
+
+struct summary {
+    int tagged;
+    unsigned long tag;
+    unsigned long games, died, quit;
+    double turns, stages, score;
+    unsigned long max_stage;
+    unsigned long stage_hist[32];
+    unsigned long causes[NUM_TILES];
+    unsigned long abilities[NUM_ABILITIES];
+};
+
+static int dump(unsigned long *columns[NUM_RESULT_COLUMNS], unsigned long n, void *arg)
+{
+    const struct summary *s = arg;
+    unsigned long i;
+    int c;
+
+    for (i = 0; i < n; ++i) {
+        if (s->tagged && columns[RESULT_TAG][i] != s->tag)
+            continue;
+        for (c = 0; c < NUM_RESULT_COLUMNS; ++c)
+            printf(c ? "\t%lu" : "%lu", columns[c][i]);
+        printf("\n");
+    }
+    return 1;
+}
+
+static int summarise(unsigned long *columns[NUM_RESULT_COLUMNS], unsigned long n, void *arg)
+{
+    struct summary *s = arg;
+    unsigned long i, stage;
+    int a;
+
+    for (i = 0; i < n; ++i) {
+        if (s->tagged && columns[RESULT_TAG][i] != s->tag)
+            continue;
+        ++s->games;
+        s->turns += columns[RESULT_TURNS][i];
+        s->stages += columns[RESULT_STAGES][i];
+        s->score += columns[RESULT_SCORE][i];
+        stage = columns[RESULT_STAGE][i];
+        if (stage > s->max_stage)
+            s->max_stage = stage;
+        ++s->stage_hist[stage < 31 ? stage : 31];
+        if (columns[RESULT_STATUS][i] == STATUS_DEAD) {
+            ++s->died;
+            if (columns[RESULT_CAUSE][i] < NUM_TILES)
+                ++s->causes[columns[RESULT_CAUSE][i]];
+        }
+        else if (columns[RESULT_STATUS][i] == STATUS_QUIT)
+            ++s->quit;
+        for (a = 1; a < NUM_ABILITIES; ++a)
+            s->abilities[a] += columns[RESULT_ABILITIES][i] >> a & 1;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *tile_names[NUM_TILES] = {
+        "floor", "repellent", "wall", "player", "root", "flower", "vine", "nectar", "exit", "sentinel"
+    };
+    struct summary s;
+    unsigned long mask;
+    double n;
+    int i, stage, dumping = 0, ok = 1, files = 0;
+
+    memset(&s, 0, sizeof(s));
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-d"))
+            dumping = 1;
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            s.tagged = 1;
+            s.tag = strtoul(argv[++i], NULL, 0);
+        }
+        else
+            argv[++files] = argv[i];
+    }
+    if (!files) {
+        fprintf(stderr, "usage: %s [-d] [-t tag] results...\n", argv[0]);
+        return 1;
+    }
+
+    if (dumping) {
+        for (i = 0; i < NUM_RESULT_COLUMNS; ++i)
+            printf(i ? "\t%s" : "%s", result_column_names[i]);
+        printf("\n");
+    }
+    mask = dumping ? ~0UL :
+           1UL << RESULT_TAG | 1UL << RESULT_STATUS | 1UL << RESULT_TURNS | 1UL << RESULT_STAGE |
+           1UL << RESULT_STAGES | 1UL << RESULT_SCORE | 1UL << RESULT_CAUSE | 1UL << RESULT_ABILITIES;
+    for (i = 1; i <= files; ++i) {
+        if (!results_scan(argv[i], mask, dumping ? dump : summarise, &s)) {
+            fprintf(stderr, "%s: missing or damaged results file\n", argv[i]);
+            ok = 0;
+        }
+    }
+    if (dumping)
+        return !ok;
+
+    n = s.games ? s.games : 1;
+    printf("%lu games: %.3f died, %.3f quit; %.1f turns, %.2f stages cleared, %.1f score\n",
+           s.games, s.died / n, s.quit / n, s.turns / n, s.stages / n, s.score / n);
+    printf("final stage:");
+    for (stage = 0; stage < 32 && stage <= (int)s.max_stage; ++stage)
+        if (s.stage_hist[stage])
+            printf(" %d%s:%lu", stage, stage == 31 ? "+" : "", s.stage_hist[stage]);
+    printf("\nkilled by:");
+    for (i = 0; i < NUM_TILES; ++i)
+        if (s.causes[i])
+            printf(" %s:%lu", tile_names[i], s.causes[i]);
+    printf("\nabilities:");
+    for (i = 1; i < NUM_ABILITIES; ++i)
+        if (s.abilities[i])
+            printf(" %s:%lu", ability_names[i], s.abilities[i]);
+    printf("\n");
+    return !ok;
+}
+
+#endif
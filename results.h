@@ -0,0 +1,63 @@
+#ifndef H_RESULTS
+#define H_RESULTS
+
+#include "bilebio.h"
+
+/* Per-game outcomes. A sink buffers records in memory and appends them to
+ * a results file a block at a time. A block stores its records column by
+ * column, each column delta- and varint-coded, so a scan reads only the
+ * columns it needs and a typical record takes a dozen bytes. Blocks are
+ * appended whole under a write lock, so any number of processes can add
+ * to one file. */
+
+#define RESULTS_MAGIC       "BBRES"
+#define RESULTS_VERSION     1
+/* Records a sink holds before it writes a block. */
+#define RESULTS_BLOCK       4096
+
+enum result_column {
+    RESULT_SEED,
+    RESULT_TAG,
+    RESULT_STATUS,
+    RESULT_TURNS,
+    RESULT_STAGE,
+    RESULT_STAGES,
+    RESULT_SCORE,
+    RESULT_ENERGY,
+    RESULT_CAUSE,
+    RESULT_X,
+    RESULT_Y,
+    RESULT_ABILITIES,
+    NUM_RESULT_COLUMNS
+};
+
+extern const char *result_column_names[NUM_RESULT_COLUMNS];
+
+/* One game, by column. seed is the one the game was dealt from, 0 if
+ * unknown (bilebio-borg -r); tag is the caller's (a grid point, a
+ * snapshot); stages counts the stages cleared in this run. cause is the
+ * tile that grew onto the player, TILE_FLOOR if the player did not die,
+ * and x, y where the game ended. abilities has bit i set for ability i learned. */
+struct result {
+    unsigned long v[NUM_RESULT_COLUMNS];
+};
+
+struct results_sink;
+
+void result_of(struct result *r, const struct bilebio *bb, unsigned long seed, unsigned long tag,
+               enum status st, unsigned long turns, unsigned long start_level);
+
+struct results_sink *results_open(const char *path);
+int results_add(struct results_sink *s, const struct result *r);
+int results_flush(struct results_sink *s);
+int results_close(struct results_sink *s);
+
+/* Calls each() with every block of the file in turn: n records, with
+ * columns[c][i] the value of column c in record i for each column whose bit
+ * is set in mask (the others are skipped unread). Returns 0 if the file is
+ * missing or damaged, or each() returned 0. */
+int results_scan(const char *path, unsigned long mask,
+                 int (*each)(unsigned long *columns[NUM_RESULT_COLUMNS], unsigned long n, void *arg),
+                 void *arg);
+
+#endif
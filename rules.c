@@ -0,0 +1,127 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bilebio.h"
+
+/* The stock game. */
+const struct rules default_rules = {
+    20,     /* root_active_base */
+    15,     /* flower_active_base */
+    10,     /* vine_active_base */
+    200,    /* root_lifespan */
+    40,     /* flower_lifespan */
+    40,     /* vine_lifespan */
+    10,     /* repellent_lifespan */
+    40,     /* nectar_half_life */
+    160,    /* nectar_chance */
+    {
+        {0, 0},
+        {10, 2},
+        {30, 2},
+        {60, 10},
+        {10, 2},
+        {30, 1},
+        {60, 50},
+        {10, 5},
+        {30, 5},
+        {60, 0},
+    },
+};
+
+/* Config key of every ability; learn_<name> and use_<name> set its costs. */
+static const char *ability_keys[NUM_ABILITIES] = {
+    "move",
+    "dash",
+    "plant_hop",
+    "repellent",
+    "attack",
+    "wall_hop",
+    "life",
+    "wall_walk",
+    "spawn_wall",
+    "energy",
+};
+
+/* Returns the field named key, or NULL. *nonzero is set for fields that
+ * are divisors or odds and must not be 0. */
+static unsigned long *rule_field(struct rules *r, const char *key, int *nonzero)
+{
+    int i;
+
+    *nonzero = 1;
+    if (!strcmp(key, "root_active_base"))
+        return &r->root_active_base;
+    if (!strcmp(key, "flower_active_base"))
+        return &r->flower_active_base;
+    if (!strcmp(key, "vine_active_base"))
+        return &r->vine_active_base;
+    if (!strcmp(key, "nectar_half_life"))
+        return &r->nectar_half_life;
+    if (!strcmp(key, "nectar_chance"))
+        return &r->nectar_chance;
+
+    *nonzero = 0;
+    if (!strcmp(key, "root_lifespan"))
+        return &r->root_lifespan;
+    if (!strcmp(key, "flower_lifespan"))
+        return &r->flower_lifespan;
+    if (!strcmp(key, "vine_lifespan"))
+        return &r->vine_lifespan;
+    if (!strcmp(key, "repellent_lifespan"))
+        return &r->repellent_lifespan;
+    for (i = 1; i < NUM_ABILITIES; ++i) {
+        if (!strncmp(key, "learn_", 6) && !strcmp(key + 6, ability_keys[i]))
+            return &r->ability_costs[i].initial;
+        if (!strncmp(key, "use_", 4) && !strcmp(key + 4, ability_keys[i]))
+            return &r->ability_costs[i].recurring;
+    }
+    return NULL;
+}
+
+/* Returns 1 if key names a rule and value is a valid setting for it.
+ * Snapshots store rules in 32 bits, so no setting may be larger. */
+int set_rule(struct rules *r, const char *key, const char *value)
+{
+    unsigned long *field, v;
+    char *end;
+    int nonzero;
+
+    if (!(field = rule_field(r, key, &nonzero)))
+        return 0;
+    v = strtoul(value, &end, 0);
+    if (end == value || *end || (nonzero && v == 0) || v > 0xffffffffUL)
+        return 0;
+    *field = v;
+    return 1;
+}
+
+/* Reads "key value" lines on top of *r; '#' starts a comment. Returns 0
+ * and reports the line on stderr if a line is not a valid rule. */
+int load_rules(struct rules *r, const char *path)
+{
+    FILE *f;
+    char line[256], key[64], value[64];
+    char *p;
+    int n = 0, ok = 1;
+
+    if (!(f = fopen(path, "r"))) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return 0;
+    }
+    while (ok && fgets(line, sizeof(line), f)) {
+        ++n;
+        if ((p = strchr(line, '#')))
+            *p = '\0';
+        for (p = line; isspace((unsigned char)*p); ++p)
+            ;
+        if (!*p)
+            continue;
+        if (sscanf(p, "%63s %63s", key, value) != 2 || !set_rule(r, key, value)) {
+            fprintf(stderr, "%s:%d: bad rule: %s", path, n, p);
+            ok = 0;
+        }
+    }
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+struct cursor {
+    unsigned char *out;
+    const unsigned char *in;
+    size_t pos, len;
+    int ok;
+};
+
+static void put(struct cursor *c, unsigned long v, int bytes)
+{
+    int i;
+    if (c->pos + bytes > c->len) {
+        c->ok = 0;
+        return;
+    }
+    for (i = 0; i < bytes; ++i)
+        c->out[c->pos++] = (unsigned char)((v >> (8 * i)) & 0xff);
+}
+
+static unsigned long get(struct cursor *c, int bytes)
+{
+    unsigned long v = 0;
+    int i;
+    if (c->pos + bytes > c->len) {
+        c->ok = 0;
+        return 0;
+    }
+    for (i = 0; i < bytes; ++i)
+        v |= (unsigned long)c->in[c->pos++] << (8 * i);
+    return v;
+}
+
+/* Tiles are stored with their age; see struct tile. The age takes 4 bytes,
+ * like stage_age, which bounds it (2 before version 4). */
+static void put_tile(struct cursor *c, const struct tile *t, unsigned long age)
+{
+    put(c, t->type, 1);
+    put(c, t->growth, 1);
+    put(c, age, 4);
+    put(c, (t->active ? 1 : 0) | (t->dead ? 2 : 0), 1);
+}
+
+static struct tile get_tile(struct cursor *c, unsigned long version)
+{
+    struct tile t;
+    unsigned long flags;
+    t.type = get(c, 1);
+    t.growth = get(c, 1);
+    t.born = get(c, version >= 4 ? 4 : 2);
+    flags = get(c, 1);
+    t.active = (flags & 1) != 0;
+    t.dead = (flags & 2) != 0;
+    if (t.type >= TILE_SENTINEL)
+        c->ok = 0;
+    return t;
+}
+
+static int same_tile(const struct bilebio *bb, const struct tile *a, const struct tile *b)
+{
+    return a->type == b->type && a->growth == b->growth && tile_age(bb, a) == tile_age(bb, b) &&
+           !a->active == !b->active && !a->dead == !b->dead;
+}
+
+#define NUM_RULE_FIELDS (9 + 2 * NUM_ABILITIES)
+
+/* The rules in the order they are stored. */
+static void rule_fields(struct rules *r, unsigned long *fields[NUM_RULE_FIELDS])
+{
+    int i, n = 0;
+    fields[n++] = &r->root_active_base;
+    fields[n++] = &r->flower_active_base;
+    fields[n++] = &r->vine_active_base;
+    fields[n++] = &r->root_lifespan;
+    fields[n++] = &r->flower_lifespan;
+    fields[n++] = &r->vine_lifespan;
+    fields[n++] = &r->repellent_lifespan;
+    fields[n++] = &r->nectar_half_life;
+    fields[n++] = &r->nectar_chance;
+    for (i = 0; i < NUM_ABILITIES; ++i) {
+        fields[n++] = &r->ability_costs[i].initial;
+        fields[n++] = &r->ability_costs[i].recurring;
+    }
+}
+
+/* Returns the encoded size, or 0 if it does not fit in cap bytes. */
+size_t snapshot_encode(const struct bilebio *bb, unsigned char *buf, size_t cap)
+{
+    struct cursor c;
+    struct rules rules = bb->rules;
+    unsigned long *fields[NUM_RULE_FIELDS];
+    unsigned long abilities = 0;
+    const struct tile *t;
+    int i, run;
+
+    c.out = buf;
+    c.in = NULL;
+    c.pos = 0;
+    c.len = cap;
+    c.ok = 1;
+
+    for (i = 0; i < 6; ++i)
+        put(&c, SNAPSHOT_MAGIC[i], 1);
+    put(&c, SNAPSHOT_VERSION, 2);
+
+    put(&c, bb->stage_level, 4);
+    put(&c, bb->stage_age, 4);
+    put(&c, bb->stage_template, 4);
+    put(&c, bb->num_nectars_placed, 4);
+    put(&c, bb->player_x, 1);
+    put(&c, bb->player_y, 1);
+    put(&c, bb->player_dead, 1);
+    put(&c, bb->player_score, 4);
+    put(&c, bb->player_energy, 4);
+    for (i = 0; i < NUM_ABILITIES; ++i)
+        if (bb->abilities[i])
+            abilities |= 1UL << i;
+    put(&c, abilities, 2);
+    put(&c, bb->selected_ability, 1);
+    put_tile(&c, &bb->under_player, bb->under_player.born);
+    put(&c, bb->rng, 4);
+    put(&c, bb->activation_seed, 4);
+    put(&c, bb->antithetic, 1);
+    rule_fields(&rules, fields);
+    for (i = 0; i < NUM_RULE_FIELDS; ++i)
+        put(&c, *fields[i], 4);
+
+    /* Runs of identical tiles, row by row. */
+    for (i = 0; i < STAGE_WIDTH * STAGE_HEIGHT; i += run) {
+        t = &STAGE(bb, i % STAGE_WIDTH, i / STAGE_WIDTH);
+        for (run = 1; i + run < STAGE_WIDTH * STAGE_HEIGHT &&
+                      same_tile(bb, t, &STAGE(bb, (i + run) % STAGE_WIDTH, (i + run) / STAGE_WIDTH)); ++run)
+            ;
+        put(&c, run, 2);
+        put_tile(&c, t, tile_age(bb, t));
+    }
+
+    return c.ok ? c.pos : 0;
+}
+
+/* Returns 1 and fills in bb if buf holds a valid snapshot, else 0 and
+ * leaves bb alone. */
+int snapshot_decode(struct bilebio *bb, const unsigned char *buf, size_t len)
+{
+    struct cursor c;
+    struct bilebio g;
+    struct tile layout[STAGE_HEIGHT][STAGE_WIDTH];
+    struct tile *cells = &layout[0][0];
+    struct tile t;
+    unsigned long *fields[NUM_RULE_FIELDS];
+    unsigned long abilities, version;
+    int i, j, run;
+
+    c.out = NULL;
+    c.in = buf;
+    c.pos = 0;
+    c.len = len;
+    c.ok = 1;
+
+    for (i = 0; i < 6; ++i)
+        if (get(&c, 1) != (unsigned char)SNAPSHOT_MAGIC[i])
+            return 0;
+    version = get(&c, 2);
+    if (version < 1 || version > SNAPSHOT_VERSION)
+        return 0;
+
+    memset(&g, 0, sizeof(g));
+    g.stage_level = get(&c, 4);
+    g.stage_age = get(&c, 4);
+    /* Older snapshots do not say which layout the stage came from. */
+    if (version >= 3)
+        g.stage_template = get(&c, 4);
+    g.num_nectars_placed = get(&c, 4);
+    g.player_x = get(&c, 1);
+    g.player_y = get(&c, 1);
+    g.player_dead = get(&c, 1);
+    g.player_score = get(&c, 4);
+    g.player_energy = get(&c, 4);
+    abilities = get(&c, 2);
+    for (i = 0; i < NUM_ABILITIES; ++i)
+        g.abilities[i] = (abilities >> i) & 1;
+    g.selected_ability = get(&c, 1);
+    g.under_player = get_tile(&c, version);
+    g.rng = get(&c, 4);
+    g.activation_seed = get(&c, 4);
+    g.antithetic = get(&c, 1);
+    /* Version 1 games were played by the default rules. */
+    g.rules = default_rules;
+    if (version >= 2) {
+        rule_fields(&g.rules, fields);
+        for (i = 0; i < NUM_RULE_FIELDS; ++i)
+            *fields[i] = get(&c, 4);
+    }
+
+    for (i = 0; c.ok && i < STAGE_WIDTH * STAGE_HEIGHT; i += run) {
+        run = get(&c, 2);
+        t = get_tile(&c, version);
+        if (run <= 0 || i + run > STAGE_WIDTH * STAGE_HEIGHT)
+            return 0;
+        t.born = g.stage_age - t.born;
+        for (j = 0; j < run; ++j)
+            cells[i + j] = t;
+    }
+
+    if (!c.ok || c.pos != len ||
+        !IN_STAGE(g.player_x, g.player_y) ||
+        layout[g.player_y][g.player_x].type != TILE_PLAYER ||
+        g.selected_ability >= NUM_ABILITIES ||
+        g.stage_level == 0 ||
+        !g.rules.root_active_base || !g.rules.flower_active_base ||
+        !g.rules.vine_active_base || !g.rules.nectar_half_life ||
+        !g.rules.nectar_chance)
+        return 0;
+
+    load_stage(&g, (const struct tile (*)[STAGE_WIDTH])layout);
+    set_activation_thresholds(&g);
+    memcpy(bb, &g, sizeof(g));
+    return 1;
+}
+
+int save_bilebio(const struct bilebio *bb, const char *path)
+{
+    unsigned char buf[SNAPSHOT_MAX_SIZE];
+    size_t n = snapshot_encode(bb, buf, sizeof(buf));
+    FILE *f;
+    int ok;
+
+    if (!n || !(f = fopen(path, "wb")))
+        return 0;
+    ok = fwrite(buf, 1, n, f) == n;
+    return fclose(f) == 0 && ok;
+}
+
+int load_bilebio(struct bilebio *bb, const char *path)
+{
+    unsigned char buf[SNAPSHOT_MAX_SIZE + 1];
+    size_t n;
+    FILE *f;
+
+    if (!(f = fopen(path, "rb")))
+        return 0;
+    n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    return n <= SNAPSHOT_MAX_SIZE && snapshot_decode(bb, buf, n);
+}
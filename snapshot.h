@@ -0,0 +1,24 @@
+#ifndef H_SNAPSHOT
+#define H_SNAPSHOT
+
+#include "bilebio.h"
+
+/* Versioned binary snapshots of a whole game: stage, player, abilities,
+ * random streams, counters and rules. Integers are little-endian and the
+ * stage is run-length encoded, so a snapshot is typically well under 1KB. */
+
+#define SNAPSHOT_MAGIC      "BBSNAP"
+/* 2: the game's rules follow the counters.
+ * 3: the stage template follows the stage age.
+ * 4: tile ages take 4 bytes instead of 2. */
+#define SNAPSHOT_VERSION    4
+/* Upper bound on the encoded size of any game. */
+#define SNAPSHOT_MAX_SIZE   (256 + 9 * STAGE_WIDTH * STAGE_HEIGHT)
+
+size_t snapshot_encode(const struct bilebio *bb, unsigned char *buf, size_t cap);
+int snapshot_decode(struct bilebio *bb, const unsigned char *buf, size_t len);
+
+int save_bilebio(const struct bilebio *bb, const char *path);
+int load_bilebio(struct bilebio *bb, const char *path);
+
+#endif
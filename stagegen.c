@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "borg.h"
+#include "stagegen.h"
+
+// Stages in flight between the workers and the (ordered) sink.
+#define STAGEGEN_WINDOW 64
+
+#define MAX_ATTEMPTS 1000
+
+static uint64_t splitmix64( uint64_t *s ) {
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int rnd( uint64_t *s, int n ) {
+    return (int)( (splitmix64( s ) >> 33) % (uint64_t) n );
+}
+
+static void put_wall( stage_t stage, int x, int y, int mirror ) {
+    // Keep the start and exit columns (and the cells next to them) open.
+    if( x < 3 || x > STAGE_WIDTH - 4 || y < 1 || y > STAGE_HEIGHT - 2 ) return;
+    stage[y][x] = make_tile( TILE_WALL );
+    if( mirror ) {
+        stage[STAGE_HEIGHT - 1 - y][x] = make_tile( TILE_WALL );
+    }
+}
+
+void generate_stage( stage_t stage, unsigned long seed ) {
+    uint64_t s = seed;
+    const int mirror = rnd( &s, 2 );
+    const int features = 3 + rnd( &s, 12 );
+
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) {
+        int border = x == 0 || y == 0 || x == STAGE_WIDTH - 1 || y == STAGE_HEIGHT - 1;
+        stage[y][x] = make_tile( border ? TILE_WALL : TILE_FLOOR );
+    }
+
+    for(int i=0;i<features;i++) {
+        int x = 3 + rnd( &s, STAGE_WIDTH - 6 );
+        int y = 1 + rnd( &s, STAGE_HEIGHT - 2 );
+        switch( rnd( &s, 4 ) ) {
+            case 0: { // Vertical wall, usually with a gap.
+                int len = 4 + rnd( &s, STAGE_HEIGHT - 4 );
+                int gap = rnd( &s, 3 ) ? rnd( &s, len ) : -1;
+                int gap_len = 2 + rnd( &s, 3 );
+                for(int j=0;j<len;j++) {
+                    if( gap >= 0 && j >= gap && j < gap + gap_len ) continue;
+                    put_wall( stage, x, y + j, mirror );
+                }
+                break;
+            }
+            case 1: { // Horizontal bar.
+                int len = 8 + rnd( &s, 50 );
+                for(int j=0;j<len;j++) put_wall( stage, x + j, y, mirror );
+                break;
+            }
+            case 2: { // Diagonal.
+                int len = 4 + rnd( &s, 8 );
+                int dx = rnd( &s, 2 ) ? 1 : -1, dy = rnd( &s, 2 ) ? 1 : -1;
+                for(int j=0;j<len;j++) put_wall( stage, x + j * dx, y + j * dy, mirror );
+                break;
+            }
+            case 3: // Pillar.
+                for(int j=0;j<4;j++) put_wall( stage, x + (j & 1), y + (j >> 1), mirror );
+                break;
+        }
+    }
+
+    const int ey = 1 + rnd( &s, STAGE_HEIGHT - 3 );
+    stage[ey][STAGE_WIDTH - 1] = make_tile( TILE_EXIT );
+    stage[ey + 1][STAGE_WIDTH - 1] = make_tile( TILE_EXIT );
+    stage[1 + rnd( &s, STAGE_HEIGHT - 2 )][1] = make_tile( TILE_PLAYER );
+}
+
+// Returns the length of the shortest path from the player to an exit,
+// or 0 if the stage cannot be solved.
+int validate_stage( const stage_t stage ) {
+    struct bilebio bb;
+    int d[STAGE_HEIGHT][STAGE_WIDTH];
+    int q[STAGE_WIDTH * STAGE_HEIGHT];
+    int px = -1, py = -1, players = 0, best = 0;
+
+    load_stage( &bb, stage );
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) {
+        if( stage[y][x].type == TILE_PLAYER ) {
+            px = x;
+            py = y;
+            players++;
+        }
+    }
+    if( players != 1 ) return 0;
+
+    calculate_distances_to( &bb, px, py, d, q );
+
+    for(int y=0;y<STAGE_HEIGHT;y++) for(int x=0;x<STAGE_WIDTH;x++) {
+        if( stage[y][x].type != TILE_EXIT || d[y][x] < 0 ) continue;
+        if( !best || d[y][x] < best ) best = d[y][x];
+    }
+    return best;
+}
+
+// Stage `index` of a corpus depends only on (seed, index), never on the
+// thread that produced it. Returns the number of attempts needed, or 0 if
+// none of MAX_ATTEMPTS gave a solvable stage.
+unsigned long generate_valid_stage( stage_t stage, unsigned long seed, unsigned long index ) {
+    uint64_t s = (uint64_t) seed ^ (0xd1b54a32d192ed03ULL * (index + 1));
+    for(unsigned long attempts=1;attempts<=MAX_ATTEMPTS;attempts++) {
+        generate_stage( stage, (unsigned long) splitmix64( &s ) );
+        if( validate_stage( (const struct tile (*)[STAGE_WIDTH]) stage ) ) return attempts;
+    }
+    return 0;
+}
+
+struct pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free, slot_ready;
+    unsigned long seed;
+    // Cut back to the first index that could not be generated.
+    unsigned long count;
+    unsigned long next_job, next_emit;
+    int stop;
+    stage_t ring[STAGEGEN_WINDOW];
+    int ready[STAGEGEN_WINDOW];
+};
+
+static void *pipeline_worker( void *arg ) {
+    struct pipeline *p = arg;
+    stage_t stage;
+
+    pthread_mutex_lock( &p->lock );
+    while( !p->stop && p->next_job < p->count ) {
+        unsigned long i = p->next_job++;
+        pthread_mutex_unlock( &p->lock );
+
+        const int valid = generate_valid_stage( stage, p->seed, i ) != 0;
+
+        pthread_mutex_lock( &p->lock );
+        if( !valid && i < p->count ) {
+            // End the corpus at stage i. Stages before it still reach the
+            // sink; the ones after are dropped.
+            p->count = i;
+            pthread_cond_broadcast( &p->slot_ready );
+            pthread_cond_broadcast( &p->slot_free );
+        }
+        while( !p->stop && i < p->count && i >= p->next_emit + STAGEGEN_WINDOW ) {
+            pthread_cond_wait( &p->slot_free, &p->lock );
+        }
+        if( p->stop ) break;
+        if( i >= p->count ) continue;
+        memcpy( p->ring[i % STAGEGEN_WINDOW], stage, sizeof stage );
+        p->ready[i % STAGEGEN_WINDOW] = 1;
+        pthread_cond_broadcast( &p->slot_ready );
+    }
+    pthread_mutex_unlock( &p->lock );
+    return 0;
+}
+
+// Generates and validates `count` stages on `threads` workers (0: one per
+// core) and hands them to `sink` in index order on the calling thread.
+// Returns the number of stages delivered: short of `count` if the sink
+// stopped early or no worker started, and if a stage could not be
+// generated, exactly the stages before the first such index.
+unsigned long stagegen_pipeline( unsigned long seed, unsigned long count, int threads,
+                                 stagegen_sink sink, void *arg ) {
+    struct pipeline *p = calloc( 1, sizeof *p );
+    pthread_t workers[64];
+    if( !p ) return 0;
+
+    if( threads <= 0 ) threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+    if( threads <= 0 ) threads = 1;
+    if( threads > 64 ) threads = 64;
+
+    pthread_mutex_init( &p->lock, 0 );
+    pthread_cond_init( &p->slot_free, 0 );
+    pthread_cond_init( &p->slot_ready, 0 );
+    p->seed = seed;
+    p->count = count;
+
+    int started = 0;
+    while( started < threads && !pthread_create( &workers[started], 0, pipeline_worker, p ) ) started++;
+
+    pthread_mutex_lock( &p->lock );
+    if( !started ) p->stop = 1;
+    while( p->next_emit < p->count ) {
+        const int slot = p->next_emit % STAGEGEN_WINDOW;
+        while( !p->ready[slot] && !p->stop && p->next_emit < p->count ) {
+            pthread_cond_wait( &p->slot_ready, &p->lock );
+        }
+        if( !p->ready[slot] ) break;
+        // The slot cannot be reused until next_emit moves past it.
+        pthread_mutex_unlock( &p->lock );
+        int more = sink( arg, p->next_emit, (const struct tile (*)[STAGE_WIDTH]) p->ring[slot] );
+        pthread_mutex_lock( &p->lock );
+
+        p->ready[slot] = 0;
+        p->next_emit++;
+        if( !more ) p->stop = 1;
+        pthread_cond_broadcast( &p->slot_free );
+        if( p->stop ) break;
+    }
+    p->stop = 1;
+    pthread_cond_broadcast( &p->slot_free );
+    pthread_mutex_unlock( &p->lock );
+
+    for(int i=0;i<started;i++) {
+        pthread_join( workers[i], 0 );
+    }
+
+    unsigned long delivered = p->next_emit;
+    pthread_cond_destroy( &p->slot_ready );
+    pthread_cond_destroy( &p->slot_free );
+    pthread_mutex_destroy( &p->lock );
+    free( p );
+    return delivered;
+}
+
+static int corpus_sink( void *arg, unsigned long index, const stage_t stage ) {
+    stage_t *corpus = arg;
+    memcpy( corpus[index], stage, sizeof corpus[index] );
+    return 1;
+}
+
+// Returns NULL unless all `count` stages could be generated.
+stage_t *stagegen_corpus( unsigned long seed, unsigned long count, int threads ) {
+    stage_t *corpus = malloc( count * sizeof *corpus );
+    if( !corpus ) return 0;
+    if( stagegen_pipeline( seed, count, threads, corpus_sink, corpus ) < count ) {
+        free( corpus );
+        return 0;
+    }
+    return corpus;
+}
+
+// Same layout as stages.inc, so a pack can be dropped in its place.
+void write_stage_pack_header( FILE *f ) {
+    fprintf( f, "\n" );
+    fprintf( f, "#define W   {TILE_WALL, 0, 0, 0, 0},\n" );
+    fprintf( f, "#define _   {TILE_FLOOR, 0, 0, 0, 0},\n" );
+    fprintf( f, "#define F   {TILE_EXIT, 0, 0, 0, 0},\n" );
+    fprintf( f, "#define P   {TILE_PLAYER, 0, 0, 0, 0},\n" );
+}
+
+void write_stage( FILE *f, const stage_t stage ) {
+    fprintf( f, "\n{\n" );
+    for(int y=0;y<STAGE_HEIGHT;y++) {
+        fprintf( f, "{" );
+        for(int x=0;x<STAGE_WIDTH;x++) {
+            int ch = '_';
+            switch( stage[y][x].type ) {
+                case TILE_WALL: ch = 'W'; break;
+                case TILE_EXIT: ch = 'F'; break;
+                case TILE_PLAYER: ch = 'P'; break;
+            }
+            fprintf( f, x ? " %c" : "%c", ch );
+        }
+        fprintf( f, "},\n" );
+    }
+    fprintf( f, "},\n" );
+}
+
+#ifdef STAGEGEN_MAIN
+
+static int pack_sink( void *arg, unsigned long index, const stage_t stage ) {
+    (void) index;
+    write_stage( arg, stage );
+    return 1;
+}
+
+int main( int argc, char **argv ) {
+    unsigned long count = 12, seed = time( 0 );
+    int threads = 0, opt;
+    FILE *out = stdout;
+
+    while( (opt = getopt( argc, argv, "n:s:j:o:" )) != -1 ) {
+        switch( opt ) {
+            case 'n': count = strtoul( optarg, 0, 0 ); break;
+            case 's': seed = strtoul( optarg, 0, 0 ); break;
+            case 'j': threads = atoi( optarg ); break;
+            case 'o':
+                out = fopen( optarg, "w" );
+                if( !out ) {
+                    perror( optarg );
+                    return 1;
+                }
+                break;
+            default:
+                fprintf( stderr, "usage: %s [-n count] [-s seed] [-j threads] [-o pack.inc]\n", argv[0] );
+                return 1;
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    write_stage_pack_header( out );
+    unsigned long n = stagegen_pipeline( seed, count, threads, pack_sink, out );
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    if( out != stdout ) fclose( out );
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    fprintf( stderr, "%lu stages (seed %lu) in %.3fs, %.0f stages/s\n", n, seed, secs, n / (secs > 0 ? secs : 1e-9) );
+    if( n < count ) {
+        fprintf( stderr, "could not generate stage %lu\n", n );
+        return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef H_STAGEGEN
+#define H_STAGEGEN
+
+#include "bilebio.h"
+
+typedef struct tile stage_t[STAGE_HEIGHT][STAGE_WIDTH];
+
+/* Called in index order; returns 0 to stop the pipeline early. */
+typedef int (*stagegen_sink)( void *arg, unsigned long index, const stage_t stage );
+
+void generate_stage( stage_t stage, unsigned long seed );
+int validate_stage( const stage_t stage );
+unsigned long generate_valid_stage( stage_t stage, unsigned long seed, unsigned long index );
+
+unsigned long stagegen_pipeline( unsigned long seed, unsigned long count, int threads,
+                                 stagegen_sink sink, void *arg );
+stage_t *stagegen_corpus( unsigned long seed, unsigned long count, int threads );
+
+void write_stage_pack_header( FILE *f );
+void write_stage( FILE *f, const stage_t stage );
+
+#endif
@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "borg.h"
+#include "results.h"
+
+// Balance sweeps: plays headless borg games under every rule set in a grid
+// and reports outcomes per grid point. The grid is the product of the
+// key=v1,v2,... arguments (keys as in a rules config, see rules.c). Game g
+// of every point uses seed + g, so points are compared on the same games.
+// Like bilebio-fork, the workers are processes reporting through a pipe;
+// with -o they also append every game to a results file, tagged with its
+// grid point. -E plays the games under ENGINE_EVENTS.
+
+#define MAX_KEYS    8
+#define MAX_VALUES  16
+
+struct axis {
+    char key[64];
+    char values[MAX_VALUES][32];
+    int n;
+};
+
+struct outcome {
+    unsigned long job;
+    unsigned long stage;
+    unsigned long turns;
+    unsigned long score;
+    int status;
+};
+
+struct point_stats {
+    double stage, stage2, turns, score;
+    unsigned long died, n;
+};
+
+static struct axis axes[MAX_KEYS];
+static int num_axes;
+static const char * results_path;
+static enum engine engine = ENGINE_SCAN;
+static struct borg borg;
+
+// Sets r to grid point p (mixed radix over the axes, last axis fastest).
+static int point_rules( struct rules * r, const struct rules * base, unsigned long p ) {
+    *r = *base;
+    for(int a=num_axes-1;a>=0;a--) {
+        if( !set_rule( r, axes[a].key, axes[a].values[p % axes[a].n] ) ) return 0;
+        p /= axes[a].n;
+    }
+    return 1;
+}
+
+static int parse_axis( struct axis * ax, const char * arg ) {
+    const char * eq = strchr( arg, '=' );
+    if( !eq || eq == arg || (size_t)(eq - arg) >= sizeof ax->key ) return 0;
+    memcpy( ax->key, arg, eq - arg );
+    ax->key[eq - arg] = 0;
+    ax->n = 0;
+    for(const char * v = eq + 1; *v && ax->n < MAX_VALUES;) {
+        size_t len = strcspn( v, "," );
+        if( !len || len >= sizeof ax->values[0] ) return 0;
+        memcpy( ax->values[ax->n], v, len );
+        ax->values[ax->n++][len] = 0;
+        v += len;
+        if( *v == ',' ) v++;
+    }
+    return ax->n > 0;
+}
+
+static void run_worker( const struct rules * base, int worker, int workers, unsigned long jobs,
+                        unsigned long games, unsigned long seed, unsigned long max_turns, int out ) {
+    struct bilebio bb;
+    struct outcome res;
+    struct result r;
+    struct results_sink * sink = results_path ? results_open( results_path ) : NULL;
+
+    for(unsigned long j=worker;j<jobs;j+=workers) {
+        struct rules rules;
+        init_bilebio( &bb, seed + j % games );
+        point_rules( &rules, base, j / games );
+        set_rules( &bb, &rules );
+        set_engine( &bb, engine );
+        borg_seed( &borg, seed + j % games );
+        res.job = j;
+        res.status = borg_play( &borg, &bb, 0, max_turns, &res.turns );
+        res.stage = bb.stage_level;
+        res.score = bb.player_score;
+        if( sink ) {
+            result_of( &r, &bb, seed + j % games, j / games, res.status, res.turns, 1 );
+            results_add( sink, &r );
+        }
+        if( write( out, &res, sizeof res ) != sizeof res ) break;
+    }
+    if( sink && !results_close( sink ) ) fprintf( stderr, "%s: could not write results\n", results_path );
+}
+
+int main( int argc, char **argv ) {
+    unsigned long games = 20, seed = time( 0 ), max_turns = 5000, points = 1;
+    int workers = sysconf( _SC_NPROCESSORS_ONLN ), opt;
+    struct rules base = default_rules, r;
+    struct bilebio bb;
+
+    while( (opt = getopt( argc, argv, "c:g:j:t:s:o:E" )) != -1 ) {
+        switch( opt ) {
+            case 'c': if( !load_rules( &base, optarg ) ) return 1; break;
+            case 'g': games = strtoul( optarg, 0, 0 ); break;
+            case 'j': workers = atoi( optarg ); break;
+            case 't': max_turns = strtoul( optarg, 0, 0 ); break;
+            case 's': seed = strtoul( optarg, 0, 0 ); break;
+            case 'o': results_path = optarg; break;
+            case 'E': engine = ENGINE_EVENTS; break;
+            default: workers = 0; break;
+        }
+    }
+    for(int i=optind;i<argc && workers > 0;i++) {
+        if( num_axes == MAX_KEYS || !parse_axis( &axes[num_axes], argv[i] ) ) workers = 0;
+        else points *= axes[num_axes++].n;
+    }
+    if( workers < 1 || !games ) {
+        fprintf( stderr, "usage: %s [-c rules] [-g games per point] [-j workers] [-t max turns] [-s seed] [-o results] [-E] key=v1,v2,...\n", argv[0] );
+        return 1;
+    }
+    for(unsigned long p=0;p<points;p++) {
+        if( !point_rules( &r, &base, p ) ) {
+            fprintf( stderr, "bad rule in grid point %lu\n", p );
+            return 1;
+        }
+    }
+
+    init_bilebio( &bb, seed );
+    if( !initialize_borg( &borg, &bb, NULL ) ) {
+        perror( "/dev/null" );
+        return 1;
+    }
+    borg.crisis_file = NULL;
+
+    struct point_stats * stats = calloc( points, sizeof *stats );
+    if( !stats ) {
+        fprintf( stderr, "Out of memory.\n" );
+        return 1;
+    }
+    struct outcome res;
+    int fds[2];
+    if( pipe( fds ) ) {
+        perror( "pipe" );
+        return 1;
+    }
+    fflush( stdout );
+    for(int w=0;w<workers;w++) {
+        if( fork() == 0 ) {
+            close( fds[0] );
+            run_worker( &base, w, workers, points * games, games, seed, max_turns, fds[1] );
+            // exit(), not _exit(), so a -fprofile-generate build writes the
+            // worker's profile; stdout was flushed before the fork.
+            exit( 0 );
+        }
+    }
+    close( fds[1] );
+    while( read( fds[0], &res, sizeof res ) == sizeof res ) {
+        struct point_stats * s = &stats[res.job / games];
+        s->stage += res.stage;
+        s->stage2 += (double)res.stage * res.stage;
+        s->turns += res.turns;
+        s->score += res.score;
+        s->died += res.status == STATUS_DEAD;
+        s->n++;
+    }
+    close( fds[0] );
+    while( wait( NULL ) > 0 );
+
+    for(int a=0;a<num_axes;a++) printf( "%-20s ", axes[a].key );
+    printf( "%6s %12s %7s %9s %9s\n", "games", "stage", "died", "turns", "score" );
+    for(unsigned long p=0;p<points;p++) {
+        const struct point_stats * s = &stats[p];
+        const double n = s->n ? s->n : 1, mean = s->stage / n;
+        const double se = s->n > 1 ? sqrt( (s->stage2 / n - mean * mean) / (n - 1) ) : 0;
+        for(int a=0;a<num_axes;a++) {
+            unsigned long stride = 1;
+            for(int b=a+1;b<num_axes;b++) stride *= axes[b].n;
+            printf( "%-20s ", axes[a].values[p / stride % axes[a].n] );
+        }
+        printf( "%6lu %6.2f±%5.2f %7.3f %9.1f %9.1f\n", s->n, mean, se, s->died / n, s->turns / n, s->score / n );
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+#ifdef BILEBIO_TRACE
+
+#define TRACE_BUFFER_EVENTS 4096
+
+struct trace_record {
+    const char *name;
+    const char *arg_name;
+    long arg;
+    double ts;
+    char phase;
+};
+
+/* Events are buffered per thread and written out under the lock when a
+ * buffer fills up, so tracing does not serialise the rollouts. */
+struct trace_buffer {
+    int tid;
+    int used;
+    struct trace_record records[TRACE_BUFFER_EVENTS];
+    struct trace_buffer *next;
+};
+
+static __thread struct trace_buffer *trace_tls = NULL;
+
+static struct trace_buffer *trace_buffers = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static struct timespec trace_epoch;
+static int trace_threads = 0;
+
+static void write_records(struct trace_buffer *b)
+{
+    int i;
+    struct trace_record *r;
+
+    for (i = 0; i < b->used; ++i) {
+        r = &b->records[i];
+        fprintf(trace_file, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d",
+                r->name, r->phase, r->ts, b->tid);
+        if (r->arg_name)
+            fprintf(trace_file, ", \"args\": {\"%s\": %ld}", r->arg_name, r->arg);
+        fprintf(trace_file, "}");
+    }
+    b->used = 0;
+}
+
+static struct trace_buffer *trace_register(void)
+{
+    struct trace_buffer *b = calloc(1, sizeof(*b));
+
+    pthread_mutex_lock(&trace_lock);
+    b->tid = ++trace_threads;
+    b->next = trace_buffers;
+    trace_buffers = b;
+    if (trace_file)
+        fprintf(trace_file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                "\"args\": {\"name\": \"%s\"}}", b->tid, b->tid == 1 ? "main" : "worker");
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_tls = b;
+    return b;
+}
+
+void trace_open(const char *path)
+{
+    pthread_mutex_lock(&trace_lock);
+    trace_file = fopen(path, "w");
+    if (trace_file) {
+        clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+        fprintf(trace_file, "[\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+                "\"args\": {\"name\": \"bilebio\"}}");
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* Call once the other threads have stopped tracing. */
+void trace_close(void)
+{
+    struct trace_buffer *b;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file) {
+        for (b = trace_buffers; b; b = b->next)
+            write_records(b);
+        fprintf(trace_file, "\n]\n");
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_event(const char *name, char phase, const char *arg_name, long arg)
+{
+    struct trace_buffer *b;
+    struct trace_record *r;
+    struct timespec now;
+
+    if (!trace_file)
+        return;
+
+    b = trace_tls ? trace_tls : trace_register();
+    if (b->used == TRACE_BUFFER_EVENTS) {
+        pthread_mutex_lock(&trace_lock);
+        if (trace_file)
+            write_records(b);
+        pthread_mutex_unlock(&trace_lock);
+        b->used = 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    r = &b->records[b->used++];
+    r->name = name;
+    r->phase = phase;
+    r->arg_name = arg_name;
+    r->arg = arg;
+    r->ts = (now.tv_sec - trace_epoch.tv_sec) * 1e6 + (now.tv_nsec - trace_epoch.tv_nsec) * 1e-3;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef H_TRACE
+#define H_TRACE
+
+/* Begin/end spans in the Chrome trace event format (load the file in
+ * chrome://tracing or ui.perfetto.dev). Compiled in only with
+ * -DBILEBIO_TRACE; every thread gets its own track. */
+
+#ifdef BILEBIO_TRACE
+
+void trace_open(const char *path);
+void trace_close(void);
+void trace_event(const char *name, char phase, const char *arg_name, long arg);
+
+#define TRACE_OPEN(path)                trace_open(path)
+#define TRACE_CLOSE()                   trace_close()
+#define TRACE_BEGIN(name)               trace_event(name, 'B', NULL, 0)
+#define TRACE_BEGIN_ARG(name, key, v)   trace_event(name, 'B', key, (long)(v))
+#define TRACE_END(name)                 trace_event(name, 'E', NULL, 0)
+
+#else
+
+#define TRACE_OPEN(path)                ((void)0)
+#define TRACE_CLOSE()                   ((void)0)
+#define TRACE_BEGIN(name)               ((void)0)
+#define TRACE_BEGIN_ARG(name, key, v)   ((void)0)
+#define TRACE_END(name)                 ((void)0)
+
+#endif
+
+#endif